@@ -0,0 +1,224 @@
+#ifndef VIZZY_ARENA_HPP
+#define VIZZY_ARENA_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+// Size-class arena
+// Small blocks come from per-class free lists carved out of 64KiB chunks, so allocating and freeing
+// is a couple of pointer moves and memory freed by one object is reused by the next of a similar
+// size instead of going back through malloc. Blocks larger than the biggest class go to malloc. The
+// caller passes the size back when freeing, as Lua does, so blocks carry no header. Not thread-safe,
+// an arena belongs to whichever thread owns what it allocates for.
+namespace vizzy {
+	inline constexpr std::array<size_t, 13> arena_classes = {
+		16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512,
+	};
+
+	inline constexpr size_t arena_granularity = 16;
+	inline constexpr size_t arena_max_block = arena_classes.back();
+	inline constexpr size_t arena_chunk_size = 64 * 1024;
+
+	struct Arena {
+		struct Block {
+			Block* next;
+		};
+
+		std::array<Block*, arena_classes.size()> free {};
+		std::vector<std::unique_ptr<std::byte[]>> chunks;
+
+		// Counters
+		uint64_t allocations = 0;
+		uint64_t frees = 0;
+		uint64_t large = 0;  // Allocations that went to malloc.
+		uint64_t failures = 0;
+
+		size_t in_use = 0;  // Bytes requested and not freed.
+		size_t peak = 0;
+		size_t reserved = 0;  // Bytes held in chunks.
+	};
+
+	namespace detail {
+		// Class index per 16 byte step, built once so finding a class is a single lookup.
+		inline constexpr auto arena_lookup = [] {
+			std::array<uint8_t, arena_max_block / arena_granularity + 1> lookup {};
+
+			for (size_t step = 0, c = 0; step != lookup.size(); ++step) {
+				while (arena_classes[c] < step * arena_granularity) {
+					++c;
+				}
+
+				lookup[step] = static_cast<uint8_t>(c);
+			}
+
+			return lookup;
+		}();
+
+		[[nodiscard]] inline size_t arena_class(size_t size) {
+			return arena_lookup[(size + arena_granularity - 1) / arena_granularity];
+		}
+
+		// Threads a new chunk onto the free list of class `c`.
+		[[nodiscard]] inline bool arena_grow(Arena& arena, size_t c) {
+			std::unique_ptr<std::byte[]> chunk { new (std::nothrow) std::byte[arena_chunk_size] };
+
+			if (chunk == nullptr) {
+				return false;
+			}
+
+			size_t block_size = arena_classes[c];
+			size_t count = arena_chunk_size / block_size;
+
+			for (size_t i = count; i != 0; --i) {
+				auto* block = reinterpret_cast<Arena::Block*>(chunk.get() + (i - 1) * block_size);
+				block->next = arena.free[c];
+				arena.free[c] = block;
+			}
+
+			arena.chunks.push_back(std::move(chunk));
+			arena.reserved += arena_chunk_size;
+
+			return true;
+		}
+
+		inline void arena_count(Arena& arena, size_t size) {
+			arena.allocations++;
+			arena.in_use += size;
+			arena.peak = std::max(arena.peak, arena.in_use);
+		}
+	}  // namespace detail
+
+	// Returns nullptr if memory is exhausted.
+	[[nodiscard]] inline void* arena_alloc(Arena& arena, size_t size) {
+		if (size > arena_max_block) {
+			void* ptr = std::malloc(size);
+
+			if (ptr == nullptr) {
+				arena.failures++;
+				return nullptr;
+			}
+
+			arena.large++;
+			detail::arena_count(arena, size);
+
+			return ptr;
+		}
+
+		size_t c = detail::arena_class(size);
+
+		if (arena.free[c] == nullptr and not detail::arena_grow(arena, c)) {
+			arena.failures++;
+			return nullptr;
+		}
+
+		Arena::Block* block = arena.free[c];
+		arena.free[c] = block->next;
+
+		detail::arena_count(arena, size);
+
+		return block;
+	}
+
+	// `size` must be the size the block was last allocated or resized to.
+	inline void arena_free(Arena& arena, void* ptr, size_t size) {
+		if (ptr == nullptr) {
+			return;
+		}
+
+		arena.frees++;
+		arena.in_use -= size;
+
+		if (size > arena_max_block) {
+			std::free(ptr);
+			return;
+		}
+
+		size_t c = detail::arena_class(size);
+
+		auto* block = static_cast<Arena::Block*>(ptr);
+		block->next = arena.free[c];
+		arena.free[c] = block;
+	}
+
+	// Blocks that stay in the same class are resized in place. Shrinking never fails: if a smaller
+	// block can't be had the old one is kept, it's at least as large as the class it'll be freed to.
+	[[nodiscard]] inline void* arena_realloc(Arena& arena, void* ptr, size_t old_size, size_t new_size) {
+		bool pooled = old_size <= arena_max_block and new_size <= arena_max_block;
+
+		if (pooled and detail::arena_class(old_size) == detail::arena_class(new_size)) {
+			arena.in_use = arena.in_use - old_size + new_size;
+			arena.peak = std::max(arena.peak, arena.in_use);
+
+			return ptr;
+		}
+
+		if (old_size > arena_max_block and new_size > arena_max_block) {
+			void* next = std::realloc(ptr, new_size);
+
+			if (next == nullptr) {
+				arena.failures++;
+				return nullptr;
+			}
+
+			arena.in_use = arena.in_use - old_size + new_size;
+			arena.peak = std::max(arena.peak, arena.in_use);
+
+			return next;
+		}
+
+		void* next = arena_alloc(arena, new_size);
+
+		if (next == nullptr and new_size < old_size) {
+			// A malloc block kept this way ends up on a free list and is only released with the process.
+			arena.in_use = arena.in_use - old_size + new_size;
+			return ptr;
+		}
+
+		if (next == nullptr) {
+			return nullptr;
+		}
+
+		std::memcpy(next, ptr, std::min(old_size, new_size));
+		arena_free(arena, ptr, old_size);
+
+		// Not a new allocation as far as the counters are concerned.
+		arena.allocations--;
+		arena.frees--;
+
+		return next;
+	}
+
+	// lua_Alloc compatible, `ud` is the arena.
+	// INFO: https://www.lua.org/manual/5.1/manual.html#lua_Alloc
+	inline void* arena_lua_alloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+		auto& arena = *static_cast<Arena*>(ud);
+
+		if (nsize == 0) {
+			arena_free(arena, ptr, osize);
+			return nullptr;
+		}
+
+		// `osize` is only a size when there's a block, newer Lua versions put the object type there.
+		if (ptr == nullptr) {
+			return arena_alloc(arena, nsize);
+		}
+
+		return arena_realloc(arena, ptr, osize, nsize);
+	}
+
+	// Every block must have been freed, chunks are released wholesale.
+	inline void destroy_arena(Arena& arena) {
+		arena.free = {};
+		arena.chunks.clear();
+		arena.reserved = 0;
+	}
+}  // namespace vizzy
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef VIZZY_BANK_HPP
+#define VIZZY_BANK_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <glad/gl.h>
+
+#include <vizzy/log.hpp>
+#include <vizzy/midi.hpp>
+#include <vizzy/env.hpp>
+
+// Envelope bank
+// Structure-of-arrays storage for many envelopes so that updating all of them is a handful of
+// linear passes over contiguous floats rather than a pointer chase per envelope.
+namespace vizzy {
+#if defined(__AVX__)
+	inline constexpr size_t bank_lanes = 8;
+#elif defined(__SSE2__)
+	inline constexpr size_t bank_lanes = 4;
+#else
+	inline constexpr size_t bank_lanes = 1;
+#endif
+
+	// Arrays are padded to a multiple of this so every kernel can run full vectors without a tail loop.
+	inline constexpr size_t bank_padding = 8;
+
+	struct EnvelopeBank {
+		// Cold data, only touched when triggering or binding.
+		std::vector<std::string_view> names;
+		std::vector<std::optional<vizzy::MidiMatch>> matches;
+		std::vector<std::function<bool(const vizzy::MidiEvent&)>> patterns;
+		std::vector<std::vector<Segment>> segments;
+
+		// Envelopes with a match are found through `routes`, the rest have their pattern offered
+		// every message.
+		vizzy::MidiRoutes routes;
+		std::vector<uint32_t> unrouted;
+
+		// Hot data, one entry per envelope (padded to `stride`).
+		std::vector<int64_t> triggers;  // vizzy::clock ticks.
+		std::vector<float> trigger_amplitudes;
+		std::vector<float> current_amplitudes;
+		std::vector<float> rest_amplitudes;  // Amplitude outside of any segment.
+		std::vector<float> relative;  // Scratch: milliseconds since trigger.
+
+		// Segment tables stored segment-major: segment `s` of envelope `i` lives at `s * stride + i`.
+		// Envelopes with fewer segments than `max_segments` are padded with segments that never match.
+		std::vector<float> seg_start;
+		std::vector<float> seg_end;
+		std::vector<float> seg_start_amp;
+		std::vector<float> seg_end_amp;
+		std::vector<float> seg_inv_duration;
+
+		size_t count = 0;
+		size_t stride = 0;
+		size_t max_segments = 0;
+
+		bool finalized = false;  // See `bank_finalize`.
+
+		// Set when levels are evaluated somewhere else, see `create_gpu_bank`. `current_amplitudes` is
+		// then left alone and triggered envelopes are collected in `fired` until they're uploaded.
+		bool deferred = false;
+		std::vector<uint32_t> fired;
+	};
+
+	namespace detail {
+		inline void bank_layout(EnvelopeBank& bank) {
+			constexpr float never = std::numeric_limits<float>::infinity();
+
+			size_t stride = (bank.count + bank_padding - 1) / bank_padding * bank_padding;
+			size_t max_segments = 0;
+
+			for (const auto& segments: bank.segments) {
+				max_segments = std::max(max_segments, segments.size());
+			}
+
+			bank.stride = stride;
+			bank.max_segments = max_segments;
+
+			bank.triggers.resize(stride, vizzy::timepoint::max().time_since_epoch().count());
+			bank.trigger_amplitudes.resize(stride, 0.f);
+			bank.current_amplitudes.resize(stride, 0.f);
+			bank.rest_amplitudes.resize(stride, 0.f);
+			bank.relative.resize(stride, 0.f);
+
+			bank.seg_start.assign(stride * max_segments, never);
+			bank.seg_end.assign(stride * max_segments, never);
+			bank.seg_start_amp.assign(stride * max_segments, 0.f);
+			bank.seg_end_amp.assign(stride * max_segments, 0.f);
+			bank.seg_inv_duration.assign(stride * max_segments, 0.f);
+
+			for (size_t i = 0; i != bank.count; ++i) {
+				const auto& segments = bank.segments[i];
+
+				bank.rest_amplitudes[i] = segments.empty() ? 0.f : segments.front().start_amp;
+
+				for (size_t s = 0; s != segments.size(); ++s) {
+					auto [start_time, end_time, start_amp, end_amp] = segments[s];
+
+					std::chrono::duration<float, std::milli> start = start_time;
+					std::chrono::duration<float, std::milli> end = end_time;
+
+					size_t index = s * stride + i;
+
+					bank.seg_start[index] = start.count();
+					bank.seg_end[index] = end.count();
+					bank.seg_start_amp[index] = start_amp;
+					bank.seg_end_amp[index] = end_amp;
+					bank.seg_inv_duration[index] = end > start ? 1.f / (end - start).count() : 0.f;
+				}
+			}
+		}
+	}  // namespace detail
+
+	// Returns the index of the new envelope. Only records it, nothing can be triggered or updated
+	// until `bank_finalize`.
+	inline size_t bank_add(EnvelopeBank& bank, const vizzy::Envelope& env) {
+		if (bank.finalized) {
+			vizzy::die("envelope '{}' added after the bank was finalized", env.name);
+		}
+
+		size_t index = bank.count++;
+
+		bank.names.emplace_back(env.name);
+		bank.matches.emplace_back(env.match);
+		bank.patterns.emplace_back(env.pattern);
+		bank.segments.emplace_back(env.segments);
+
+		if (not env.match.has_value() and env.pattern) {
+			bank.unrouted.push_back(static_cast<uint32_t>(index));
+		}
+
+		// Padded to `stride` by the layout.
+		bank.triggers.push_back(env.trigger.time_since_epoch().count());
+		bank.trigger_amplitudes.push_back(env.trigger_amplitude);
+		bank.current_amplitudes.push_back(env.current_amplitude);
+
+		return index;
+	}
+
+	// Builds the routing table and segment tables once every envelope has been added. Both cover the
+	// whole bank, so doing this per `bank_add` would make setup quadratic in the number of envelopes.
+	inline void bank_finalize(EnvelopeBank& bank) {
+		VIZZY_FUNCTION();
+
+		bank.routes = vizzy::midi_routes(bank.matches);
+		detail::bank_layout(bank);
+
+		bank.finalized = true;
+
+		VIZZY_DEBUG("envelopes = {}, stride = {}, segments = {}", bank.count, bank.stride, bank.max_segments);
+	}
+
+	namespace detail {
+		// Level of envelope `i` at `t` milliseconds since its trigger.
+		[[nodiscard]] inline float bank_evaluate(const EnvelopeBank& bank, size_t i, float t) {
+			// Triggers can be scheduled slightly ahead, hold where we were until then.
+			float amp = t < 0.f ? bank.trigger_amplitudes[i] : bank.rest_amplitudes[i];
+
+			for (size_t s = 0; s != bank.max_segments; ++s) {
+				size_t index = s * bank.stride + i;
+
+				if (t >= bank.seg_start[index] and t < bank.seg_end[index]) {
+					float from = s == 0 ? bank.trigger_amplitudes[i] : bank.seg_start_amp[index];
+					float x = (t - bank.seg_start[index]) * bank.seg_inv_duration[index];
+
+					amp = linear(from, bank.seg_end_amp[index], x);
+				}
+			}
+
+			return amp;
+		}
+
+		[[nodiscard]] inline float bank_level(const EnvelopeBank& bank, size_t i, vizzy::timepoint time) {
+			using ticks = vizzy::clock::duration;
+			constexpr float to_ms = std::chrono::duration<float, std::milli>(ticks(1)).count();
+
+			int64_t since = time.time_since_epoch().count() - bank.triggers[i];
+			return bank_evaluate(bank, i, static_cast<float>(since) * to_ms);
+		}
+
+		inline void bank_fire(EnvelopeBank& bank, size_t index, vizzy::timepoint time) {
+			// Without per-frame levels the envelope is evaluated once, at the moment it's retriggered.
+			if (bank.deferred) {
+				bank.trigger_amplitudes[index] = bank_level(bank, index, time);
+				bank.fired.push_back(static_cast<uint32_t>(index));
+			}
+
+			else {
+				bank.trigger_amplitudes[index] = bank.current_amplitudes[index];
+			}
+
+			bank.triggers[index] = time.time_since_epoch().count();
+		}
+	}  // namespace detail
+
+	// Only visits envelopes the message can affect, plus any that still rely on a predicate.
+	inline void bank_trigger(EnvelopeBank& bank, const vizzy::MidiEvent& ev, vizzy::timepoint time) {
+		for (uint32_t i: vizzy::midi_route(bank.routes, ev)) {
+			const auto& match = bank.matches[i].value();
+
+			if (ev.data2 >= match.data2_min and ev.data2 <= match.data2_max) {
+				detail::bank_fire(bank, i, time);
+			}
+		}
+
+		for (uint32_t i: bank.unrouted) {
+			if (bank.patterns[i](ev)) {
+				detail::bank_fire(bank, i, time);
+			}
+		}
+	}
+
+	inline void bank_trigger(EnvelopeBank& bank, const vizzy::MidiEvent& ev) {
+		bank_trigger(bank, ev, vizzy::clock::now());
+	}
+}  // namespace vizzy
+
+// Kernels
+namespace vizzy {
+	namespace detail {
+		// Milliseconds since trigger for every envelope. Kept as a separate pass so the 64-bit
+		// subtraction happens before anything is narrowed to float.
+		inline void bank_relative(EnvelopeBank& bank, vizzy::timepoint current_time) {
+			using ticks = vizzy::clock::duration;
+			constexpr float to_ms = std::chrono::duration<float, std::milli>(ticks(1)).count();
+
+			int64_t now = current_time.time_since_epoch().count();
+
+			const int64_t* triggers = bank.triggers.data();
+			float* relative = bank.relative.data();
+
+			for (size_t i = 0; i != bank.stride; ++i) {
+				relative[i] = static_cast<float>(now - triggers[i]) * to_ms;
+			}
+		}
+
+		// Reference implementation, also used when no vector extensions are available.
+		inline void bank_kernel_scalar(EnvelopeBank& bank, size_t first, size_t last) {
+			for (size_t i = first; i != last; ++i) {
+				bank.current_amplitudes[i] = bank_evaluate(bank, i, bank.relative[i]);
+			}
+		}
+
+#if defined(__AVX__)
+		inline void bank_kernel_simd(EnvelopeBank& bank) {
+			const __m256 one = _mm256_set1_ps(1.f);
+
+			for (size_t i = 0; i != bank.stride; i += 8) {
+				__m256 t = _mm256_loadu_ps(bank.relative.data() + i);
+				__m256 amp = _mm256_blendv_ps(_mm256_loadu_ps(bank.rest_amplitudes.data() + i),
+					_mm256_loadu_ps(bank.trigger_amplitudes.data() + i),
+					_mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_LT_OQ));
+
+				for (size_t s = 0; s != bank.max_segments; ++s) {
+					size_t index = s * bank.stride + i;
+
+					__m256 start = _mm256_loadu_ps(bank.seg_start.data() + index);
+					__m256 end = _mm256_loadu_ps(bank.seg_end.data() + index);
+
+					__m256 inside = _mm256_and_ps(_mm256_cmp_ps(t, start, _CMP_GE_OQ), _mm256_cmp_ps(t, end, _CMP_LT_OQ));
+
+					__m256 from = _mm256_loadu_ps((s == 0 ? bank.trigger_amplitudes.data() + i : bank.seg_start_amp.data() + index));
+					__m256 to = _mm256_loadu_ps(bank.seg_end_amp.data() + index);
+					__m256 x = _mm256_mul_ps(_mm256_sub_ps(t, start), _mm256_loadu_ps(bank.seg_inv_duration.data() + index));
+
+					__m256 value = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(one, x), from), _mm256_mul_ps(x, to));
+
+					amp = _mm256_blendv_ps(amp, value, inside);
+				}
+
+				_mm256_storeu_ps(bank.current_amplitudes.data() + i, amp);
+			}
+		}
+#elif defined(__SSE2__)
+		inline void bank_kernel_simd(EnvelopeBank& bank) {
+			const __m128 one = _mm_set1_ps(1.f);
+
+			for (size_t i = 0; i != bank.stride; i += 4) {
+				__m128 t = _mm_loadu_ps(bank.relative.data() + i);
+				__m128 early = _mm_cmplt_ps(t, _mm_setzero_ps());
+
+				__m128 amp = _mm_or_ps(_mm_and_ps(early, _mm_loadu_ps(bank.trigger_amplitudes.data() + i)),
+					_mm_andnot_ps(early, _mm_loadu_ps(bank.rest_amplitudes.data() + i)));
+
+				for (size_t s = 0; s != bank.max_segments; ++s) {
+					size_t index = s * bank.stride + i;
+
+					__m128 start = _mm_loadu_ps(bank.seg_start.data() + index);
+					__m128 end = _mm_loadu_ps(bank.seg_end.data() + index);
+
+					__m128 inside = _mm_and_ps(_mm_cmpge_ps(t, start), _mm_cmplt_ps(t, end));
+
+					__m128 from = _mm_loadu_ps((s == 0 ? bank.trigger_amplitudes.data() + i : bank.seg_start_amp.data() + index));
+					__m128 to = _mm_loadu_ps(bank.seg_end_amp.data() + index);
+					__m128 x = _mm_mul_ps(_mm_sub_ps(t, start), _mm_loadu_ps(bank.seg_inv_duration.data() + index));
+
+					__m128 value = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(one, x), from), _mm_mul_ps(x, to));
+
+					// SSE2 has no blendv so select with and/andnot/or.
+					amp = _mm_or_ps(_mm_and_ps(inside, value), _mm_andnot_ps(inside, amp));
+				}
+
+				_mm_storeu_ps(bank.current_amplitudes.data() + i, amp);
+			}
+		}
+#else
+		inline void bank_kernel_simd(EnvelopeBank& bank) {
+			bank_kernel_scalar(bank, 0, bank.stride);
+		}
+#endif
+	}  // namespace detail
+
+	inline void bank_update(EnvelopeBank& bank, vizzy::timepoint current_time) {
+		if (bank.count == 0) {
+			return;
+		}
+
+		detail::bank_relative(bank, current_time);
+		detail::bank_kernel_simd(bank);
+	}
+
+	inline void bank_update_scalar(EnvelopeBank& bank, vizzy::timepoint current_time) {
+		if (bank.count == 0) {
+			return;
+		}
+
+		detail::bank_relative(bank, current_time);
+		detail::bank_kernel_scalar(bank, 0, bank.stride);
+	}
+}  // namespace vizzy
+
+#endif
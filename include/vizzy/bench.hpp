@@ -0,0 +1,437 @@
+#ifndef VIZZY_BENCH_HPP
+#define VIZZY_BENCH_HPP
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include <vizzy/log.hpp>
+#include <vizzy/env.hpp>
+#include <vizzy/bank.hpp>
+#include <vizzy/context.hpp>
+#include <vizzy/handle.hpp>
+#include <vizzy/effects.hpp>
+#include <vizzy/arena.hpp>
+#include <vizzy/scene.hpp>
+
+// Benchmarks
+// Run with `--bench <name>`, each one prints its results and the process exits.
+namespace vizzy {
+	namespace detail {
+		template <typename F>
+		[[nodiscard]] inline double bench_time_ms(F&& fn) {
+			auto start = vizzy::clock::now();
+			fn();
+			std::chrono::duration<double, std::milli> elapsed = vizzy::clock::now() - start;
+
+			return elapsed.count();
+		}
+
+		inline void bench_report(std::string_view name, size_t work, double ms, std::string_view unit = "envelopes") {
+			double rate = static_cast<double>(work) / ms;
+			vizzy::log(LogKind::Okay, "{:<24} {:>10.3f}ms {:>14.0f} {}/ms", name, ms, rate, unit);
+		}
+	}  // namespace detail
+
+	// Compares the per-object `env_update` path against the envelope bank.
+	inline void bench_envelopes(size_t count = 4096, size_t iterations = 1000) {
+		using namespace std::chrono_literals;
+
+		VIZZY_OKAY("envelopes = {}, iterations = {}, lanes = {}", count, iterations, vizzy::bank_lanes);
+
+		auto origin = vizzy::clock::now();
+
+		// Stagger triggers and shapes so envelopes land in different segments.
+		std::vector<vizzy::Envelope> envelopes;
+
+		for (size_t i = 0; i != count; ++i) {
+			auto attack = vizzy::timeunit(10 + (i % 7) * 10);
+			auto hold = vizzy::timeunit(i % 5 * 20);
+			auto release = vizzy::timeunit(100 + (i % 11) * 25);
+
+			envelopes.push_back(vizzy::Envelope {
+				.name = "bench",
+				.match = {},
+				.pattern = {},
+				.segments = vizzy::attack_hold_release(attack, hold, release),
+				.trigger = origin + vizzy::timeunit(i % 97),
+			});
+		}
+
+		vizzy::EnvelopeBank bank;
+
+		for (const auto& env: envelopes) {
+			vizzy::bank_add(bank, env);
+		}
+
+		vizzy::bank_finalize(bank);
+
+		size_t work = count * iterations;
+		float checksum = 0.f;
+
+		double object_ms = detail::bench_time_ms([&] {
+			for (size_t k = 0; k != iterations; ++k) {
+				auto now = origin + vizzy::timeunit(k % 600);
+
+				for (auto& env: envelopes) {
+					env = vizzy::env_update(std::move(env), now);
+				}
+
+				checksum += envelopes[k % count].current_amplitude;
+			}
+		});
+
+		double scalar_ms = detail::bench_time_ms([&] {
+			for (size_t k = 0; k != iterations; ++k) {
+				vizzy::bank_update_scalar(bank, origin + vizzy::timeunit(k % 600));
+				checksum += bank.current_amplitudes[k % count];
+			}
+		});
+
+		double simd_ms = detail::bench_time_ms([&] {
+			for (size_t k = 0; k != iterations; ++k) {
+				vizzy::bank_update(bank, origin + vizzy::timeunit(k % 600));
+				checksum += bank.current_amplitudes[k % count];
+			}
+		});
+
+		detail::bench_report("env_update", work, object_ms);
+		detail::bench_report("bank_update_scalar", work, scalar_ms);
+		detail::bench_report("bank_update", work, simd_ms);
+
+		// Both paths were last evaluated at the same time so they should agree.
+		float error = 0.f;
+
+		for (size_t i = 0; i != count; ++i) {
+			error = std::max(error, std::abs(envelopes[i].current_amplitude - bank.current_amplitudes[i]));
+		}
+
+		VIZZY_OKAY("speedup = {:.2f}x, max error = {}, checksum = {}", object_ms / simd_ms, error, checksum);
+	}
+
+	namespace detail {
+		// Tick times of a script that makes garbage every tick, with the default allocator collecting
+		// whenever Lua decides to against the arena with a budgeted step at the end of each tick.
+		inline void bench_lua_gc(size_t ticks = 5000) {
+			using ms = std::chrono::duration<double, std::milli>;
+
+			constexpr std::string_view churn = R"(
+				function tick()
+					local notes = {}
+					for i = 1, 256 do notes[i] = { note = i, name = "note " .. i } end
+					return #notes
+				end
+			)";
+
+			auto run = [&](std::string_view name, sol::state& lua, GcBudget* gc) {
+				if (auto result = lua.safe_script(churn, sol::script_pass_on_error); not result.valid()) {
+					vizzy::die("bench script failed: {}", result.get<sol::error>().what());
+				}
+
+				sol::protected_function tick = lua["tick"];
+				std::vector<vizzy::clock::duration> samples(ticks);
+
+				for (auto& sample: samples) {
+					auto begin = vizzy::clock::now();
+					tick();
+
+					if (gc != nullptr) {
+						gc_step(*gc, lua.lua_state());
+					}
+
+					sample = vizzy::clock::now() - begin;
+				}
+
+				vizzy::log(LogKind::Okay,
+					"{:<24} mean {:>8.3f}ms p99 {:>8.3f}ms max {:>8.3f}ms",
+					name,
+					ms(std::accumulate(samples.begin(), samples.end(), vizzy::clock::duration {})).count() /
+						static_cast<double>(ticks),
+					ms(vizzy::percentile(samples, .99)).count(),
+					ms(*std::max_element(samples.begin(), samples.end())).count());
+			};
+
+			VIZZY_OKAY("ticks = {}", ticks);
+
+			{
+				sol::state lua;
+				lua.open_libraries(sol::lib::base);
+
+				run("automatic gc", lua, nullptr);
+			}
+
+			Arena arena;
+			GcBudget gc;
+
+			{
+				sol::state lua { sol::default_at_panic, arena_lua_alloc, &arena };
+				lua.open_libraries(sol::lib::base);
+
+				lua_gc(lua.lua_state(), LUA_GCSTOP, 0);
+
+				run("arena, budgeted gc", lua, &gc);
+			}
+
+			VIZZY_OKAY(
+				"gc: steps = {}, cycles = {}, forced = {}, worst = {:.3f}ms; arena: allocations = {}, "
+				"peak = {:.1f}KiB",
+				gc.steps,
+				gc.cycles,
+				gc.forced,
+				ms(gc.worst).count(),
+				arena.allocations,
+				static_cast<double>(arena.peak) / 1024.0);
+
+			destroy_arena(arena);
+		}
+	}  // namespace detail
+
+	// Compares ways for a script to read every envelope level and write a value per entry, as a scene
+	// driving a per-note array would: a bound function per value, tables filled and read back through
+	// sol2, and the buffer views element by element, in bulk and through LuaJIT's FFI when available.
+	// Then times garbage collection with and without the arena and budget.
+	inline void bench_lua(size_t count = 512, size_t iterations = 1000) {
+		VIZZY_OKAY("values = {}, iterations = {}", count, iterations);
+
+		sol::state lua;
+		lua.open_libraries(sol::lib::base, sol::lib::math, sol::lib::table, sol::lib::ffi, sol::lib::jit);
+
+		vizzy::view_register(lua);
+
+		std::vector<float> levels(count);
+		std::vector<float> output(count);
+
+		for (size_t i = 0; i != count; ++i) {
+			levels[i] = static_cast<float>(i) / static_cast<float>(count);
+		}
+
+		// Writable only so the ffi case can take its pointer, the script never writes it.
+		FloatView input_view { levels.data(), count, true };
+		FloatView output_view { output.data(), count, true };
+
+		lua["count"] = count;
+		lua["input"] = &input_view;
+		lua["output"] = &output_view;
+
+		lua.set_function("get_level", [&](size_t i) { return levels.at(i - 1); });
+		lua.set_function("set_output", [&](size_t i, float value) { output.at(i - 1) = value; });
+
+		auto loaded = lua.safe_script(R"(
+			function per_call()
+				for i = 1, count do set_output(i, get_level(i) * 0.5) end
+			end
+
+			function per_table(levels, output)
+				for i = 1, count do output[i] = levels[i] * 0.5 end
+			end
+
+			function view_element()
+				for i = 1, count do output:set(i, input:get(i) * 0.5) end
+			end
+
+			function view_bulk()
+				local t = input:read()
+				for i = 1, count do t[i] = t[i] * 0.5 end
+				output:write(t)
+			end
+
+			function view_ffi()
+				local src = ffi.cast("float*", input:pointer())
+				local dst = ffi.cast("float*", output:pointer())
+				for i = 0, count - 1 do dst[i] = src[i] * 0.5 end
+			end
+		)",
+			sol::script_pass_on_error);
+
+		if (not loaded.valid()) {
+			vizzy::die("bench script failed: {}", loaded.get<sol::error>().what());
+		}
+
+		sol::table level_table = lua.create_table(static_cast<int>(count), 0);
+		sol::table output_table = lua.create_table(static_cast<int>(count), 0);
+
+		// Tables have to be refreshed and read back every frame to stand in for the buffers.
+		auto per_table = [&, fn = sol::protected_function { lua["per_table"] }] {
+			for (size_t i = 0; i != count; ++i) {
+				level_table[i + 1] = levels[i];
+			}
+
+			fn(level_table, output_table);
+
+			for (size_t i = 0; i != count; ++i) {
+				output[i] = output_table.get<float>(i + 1);
+			}
+		};
+
+		auto bench = [&](std::string_view name, auto&& fn) {
+			std::ranges::fill(output, 0.f);
+			fn();
+
+			// Every variant computes the same thing, a mismatch means it didn't run.
+			for (size_t i = 0; i != count; ++i) {
+				if (output[i] != levels[i] * .5f) {
+					vizzy::die("{} produced {} at {}, expected {}", name, output[i], i, levels[i] * .5f);
+				}
+			}
+
+			double ms = detail::bench_time_ms([&] {
+				for (size_t k = 0; k != iterations; ++k) {
+					fn();
+				}
+			});
+
+			detail::bench_report(name, count * iterations, ms, "values");
+
+			return ms;
+		};
+
+		auto script = [&](std::string_view name) {
+			return [fn = sol::protected_function { lua[name] }, name] {
+				if (auto result = fn(); not result.valid()) {
+					vizzy::die("{} failed: {}", name, result.get<sol::error>().what());
+				}
+			};
+		};
+
+		double call_ms = bench("function per value", script("per_call"));
+		bench("table", per_table);
+		bench("view get/set", script("view_element"));
+		double bulk_ms = bench("view read/write", script("view_bulk"));
+
+		if (lua["jit"].get_type() == sol::type::table) {
+			bench("view ffi", script("view_ffi"));
+		}
+
+		else {
+			VIZZY_WARN("not running against LuaJIT, skipping ffi");
+		}
+
+		VIZZY_OKAY("bulk speedup over function per value = {:.2f}x", call_ms / bulk_ms);
+
+		detail::bench_lua_gc();
+	}
+
+	// Times each compute effect against the same source built as a fragment shader pass. Runs headless
+	// at the size in `config`.
+	inline void bench_effects(vizzy::ContextConfig config, size_t iterations = 100) {
+		auto context = vizzy::create_headless_context(config);
+
+		int width = config.width;
+		int height = config.height;
+
+		VIZZY_OKAY("size = {}x{}, iterations = {}", width, height, iterations);
+
+		gl::ProgramCache cache;
+
+		// Noise so nothing is trivially uniform.
+		std::vector<float> pixels(static_cast<size_t>(width * height * 4));
+		std::minstd_rand rng { 1 };
+		std::uniform_real_distribution<float> dist { 0.f, 1.f };
+
+		for (auto& px: pixels) {
+			px = dist(rng);
+		}
+
+		gl::TextureHandle input = gl::detail::effect_image(width, height);
+		gl::TextureHandle output = gl::detail::effect_image(width, height);
+
+		gl::call(glTextureSubImage2D, input, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, pixels.data());
+
+		gl::VertexArrayHandle vao;
+		glCreateVertexArrays(1, &vao.id);
+		glBindVertexArray(vao);
+
+		for (const auto& desc: gl::effect_descs) {
+			auto chain = gl::create_effect_chain(cache, { desc.name }, width, height);
+			const gl::Effect& effect = chain.effects.front();
+
+			gl::effect_chain_run(chain, input, output, GL_TEXTURE_FETCH_BARRIER_BIT);
+
+			double compute_ms = gl::detail::effect_time_ms([&] {
+				for (size_t k = 0; k != iterations; ++k) {
+					gl::effect_chain_run(chain, input, output, GL_TEXTURE_FETCH_BARRIER_BIT);
+				}
+			});
+
+			// Fragment equivalent, ping-ponging through framebuffers instead of images.
+			std::vector<gl::Program> programs;
+
+			for (size_t step = 0; step != desc.steps; ++step) {
+				programs.push_back(gl::detail::effect_fragment_program(cache, desc, step));
+			}
+
+			std::array<GLuint, 2> targets { chain.images[0], output };
+			std::array<gl::FramebufferHandle, 2> framebuffers;
+
+			for (size_t i = 0; i != 2; ++i) {
+				glCreateFramebuffers(1, &framebuffers[i].id);
+				glNamedFramebufferTexture(framebuffers[i], GL_COLOR_ATTACHMENT0, targets[i], 0);
+			}
+
+			glViewport(0, 0, width, height);
+
+			auto fragment = [&] {
+				GLuint src = input;
+
+				for (size_t step = 0; step != programs.size(); ++step) {
+					size_t dst = step + 1 == programs.size() ? 1 : 0;
+
+					glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[dst]);
+					glBindTextureUnit(0, src);
+
+					if (effect.history != 0) {
+						glBindImageTexture(2, effect.history, 0, GL_FALSE, 0, GL_READ_WRITE, gl::effect_format);
+					}
+
+					glUseProgram(programs[step].id);
+					glDrawArrays(GL_TRIANGLES, 0, 3);
+
+					src = targets[dst];
+				}
+
+				if (effect.history != 0) {
+					glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+				}
+			};
+
+			fragment();
+
+			double fragment_ms = gl::detail::effect_time_ms([&] {
+				for (size_t k = 0; k != iterations; ++k) {
+					fragment();
+				}
+			});
+
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+			compute_ms /= static_cast<double>(iterations);
+			fragment_ms /= static_cast<double>(iterations);
+
+			vizzy::log(LogKind::Okay,
+				"{:<10} compute {:>8.3f}ms ({:>2}x{:<2}) fragment {:>8.3f}ms {:>6.2f}x",
+				desc.name,
+				compute_ms,
+				effect.local[0],
+				effect.local[1],
+				fragment_ms,
+				fragment_ms / compute_ms);
+
+			gl::destroy_effect_chain(chain);
+		}
+
+		input = {};
+		output = {};
+		vao = {};
+
+		gl::deletion_flush();
+		vizzy::destroy_context(context);
+	}
+}  // namespace vizzy
+
+#endif
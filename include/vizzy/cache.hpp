@@ -0,0 +1,267 @@
+#ifndef VIZZY_CACHE_HPP
+#define VIZZY_CACHE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include <vizzy/util.hpp>
+#include <vizzy/log.hpp>
+#include <vizzy/gl.hpp>
+
+// Program binary cache
+// Linked programs are stored as `glGetProgramBinary` blobs named after a hash of everything that
+// could change the result: driver vendor/renderer/version and every stage's sources, which include
+// the generated declarations and defines. A blob the driver rejects is deleted and the program is
+// compiled as usual.
+namespace vizzy::gl {
+	struct ShaderSource {
+		GLenum kind;
+		std::vector<std::string_view> sources;
+	};
+
+	struct ProgramCache {
+		std::filesystem::path directory;
+		std::string driver;  // Vendor, renderer and version, part of every key.
+
+		bool enabled = false;
+
+		size_t hits = 0;
+		size_t misses = 0;
+		size_t rejected = 0;
+
+		double saved_ms = 0.0;  // Compile time recorded with each blob minus the time to load it.
+	};
+
+	namespace detail {
+		inline constexpr uint32_t program_cache_magic = 0x4250'5A56;  // "VZPB"
+		inline constexpr uint32_t program_cache_version = 1;
+
+		struct ProgramCacheHeader {
+			uint32_t magic = program_cache_magic;
+			uint32_t version = program_cache_version;
+			uint32_t format = 0;
+			uint32_t length = 0;
+			float compile_ms = 0.f;
+		};
+
+		[[nodiscard]] inline std::string gl_string(GLenum name) {
+			const GLubyte* str = glGetString(name);
+			return str == nullptr ? std::string {} : std::string { reinterpret_cast<const char*>(str) };
+		}
+
+		[[nodiscard]] inline std::filesystem::path program_cache_path(
+			const ProgramCache& cache, const std::vector<ShaderSource>& stages, bool separable = false) {
+			uint64_t hash = vizzy::fnv1a(cache.driver);
+
+			if (separable) {
+				hash = vizzy::fnv1a("\nseparable\n", hash);
+			}
+
+			for (const auto& [kind, sources]: stages) {
+				hash = vizzy::fnv1a(fmt::format("\n{:#x}\n", kind), hash);
+
+				for (auto sv: sources) {
+					hash = vizzy::fnv1a(sv, hash);
+				}
+			}
+
+			return cache.directory / fmt::format("{:016x}.bin", hash);
+		}
+
+		// Returns 0 when there's no usable blob.
+		[[nodiscard]] inline GLuint program_cache_load(ProgramCache& cache, const std::filesystem::path& path) {
+			std::ifstream is { path, std::ios::binary };
+
+			if (not is.is_open()) {
+				return 0;
+			}
+
+			ProgramCacheHeader header;
+			is.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+			if (not is or header.magic != program_cache_magic or header.version != program_cache_version) {
+				return 0;
+			}
+
+			std::vector<char> binary(header.length);
+			is.read(binary.data(), static_cast<std::streamsize>(binary.size()));
+
+			if (not is) {
+				return 0;
+			}
+
+			GLuint program = call(glCreateProgram);
+
+			// Deliberately unchecked, an unknown format is an error we recover from.
+			glProgramBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+			while (glGetError() != GL_NO_ERROR) {}
+
+			if (gl_get_program(program, GL_LINK_STATUS) != GL_TRUE) {
+				VIZZY_WARN("driver rejected cached program '{}'", path.string());
+
+				glDeleteProgram(program);
+
+				std::error_code ec;
+				std::filesystem::remove(path, ec);
+
+				cache.rejected++;
+				return 0;
+			}
+
+			cache.saved_ms += header.compile_ms;
+			return program;
+		}
+
+		inline void program_cache_store(const std::filesystem::path& path, GLuint program, float compile_ms) {
+			GLint length = gl_get_program(program, GL_PROGRAM_BINARY_LENGTH);
+
+			if (length <= 0) {
+				return;
+			}
+
+			std::vector<char> binary(static_cast<size_t>(length));
+
+			GLenum format = GL_NONE;
+			call(glGetProgramBinary, program, length, nullptr, &format, binary.data());
+
+			ProgramCacheHeader header {
+				.format = format,
+				.length = static_cast<uint32_t>(length),
+				.compile_ms = compile_ms,
+			};
+
+			// Write then rename so a crash or a second instance never leaves a torn blob behind.
+			auto tmp = path;
+			tmp += ".tmp";
+
+			{
+				std::ofstream os { tmp, std::ios::binary };
+
+				if (not os.is_open()) {
+					VIZZY_WARN("cannot write '{}'", tmp.string());
+					return;
+				}
+
+				os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				os.write(binary.data(), static_cast<std::streamsize>(binary.size()));
+			}
+
+			std::error_code ec;
+			std::filesystem::rename(tmp, path, ec);
+
+			if (ec) {
+				VIZZY_WARN("cannot write '{}': {}", path.string(), ec.message());
+			}
+		}
+	}  // namespace detail
+
+	// `$XDG_CACHE_HOME/vizzy`, falling back to `~/.cache/vizzy`.
+	[[nodiscard]] inline std::filesystem::path default_program_cache_directory() {
+		if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg != nullptr and *xdg != '\0') {
+			return std::filesystem::path { xdg } / "vizzy";
+		}
+
+		if (const char* home = std::getenv("HOME"); home != nullptr and *home != '\0') {
+			return std::filesystem::path { home } / ".cache" / "vizzy";
+		}
+
+		return ".vizzy-cache";
+	}
+
+	// Needs a current context. Pass an empty path to disable caching.
+	[[nodiscard]] inline ProgramCache create_program_cache(std::filesystem::path directory) {
+		VIZZY_FUNCTION();
+
+		ProgramCache cache;
+		cache.directory = directory;
+
+		if (directory.empty()) {
+			return cache;
+		}
+
+		if (gl_get_integer(GL_NUM_PROGRAM_BINARY_FORMATS) == 0) {
+			VIZZY_WARN("driver has no program binary formats, not caching programs");
+			return cache;
+		}
+
+		std::error_code ec;
+		std::filesystem::create_directories(directory, ec);
+
+		if (ec) {
+			VIZZY_WARN("cannot create '{}': {}, not caching programs", directory.string(), ec.message());
+			return cache;
+		}
+
+		cache.driver = fmt::format("{}\n{}\n{}",
+			detail::gl_string(GL_VENDOR),
+			detail::gl_string(GL_RENDERER),
+			detail::gl_string(GL_VERSION));
+
+		cache.enabled = true;
+
+		VIZZY_DEBUG("directory = '{}'", directory.string());
+
+		return cache;
+	}
+
+	// Same result as compiling every stage and passing them to `create_program`.
+	[[nodiscard]] inline Program cached_program(ProgramCache& cache, const std::vector<ShaderSource>& stages) {
+		VIZZY_FUNCTION();
+
+		using ms = std::chrono::duration<float, std::milli>;
+
+		auto start = vizzy::clock::now();
+		auto path = cache.enabled ? detail::program_cache_path(cache, stages) : std::filesystem::path {};
+
+		if (cache.enabled) {
+			if (GLuint program = detail::program_cache_load(cache, path); program != 0) {
+				float load_ms = ms(vizzy::clock::now() - start).count();
+
+				cache.hits++;
+				cache.saved_ms -= load_ms;
+
+				VIZZY_OKAY("loaded cached program ({}) in {:.2f}ms", program, load_ms);
+
+				return Program { ProgramHandle { program }, reflect_uniforms(program) };
+			}
+
+			cache.misses++;
+		}
+
+		std::vector<GLuint> shaders;
+
+		for (const auto& [kind, sources]: stages) {
+			shaders.push_back(create_shader(kind, sources));
+		}
+
+		Program program = create_program(shaders);
+
+		if (cache.enabled) {
+			detail::program_cache_store(path, program.id, ms(vizzy::clock::now() - start).count());
+		}
+
+		return program;
+	}
+
+	inline void program_cache_report(const ProgramCache& cache) {
+		if (not cache.enabled) {
+			return;
+		}
+
+		VIZZY_OKAY("program cache: hits = {}, misses = {}, rejected = {}, saved = {:.2f}ms",
+			cache.hits,
+			cache.misses,
+			cache.rejected,
+			cache.saved_ms);
+	}
+}  // namespace vizzy::gl
+
+#endif
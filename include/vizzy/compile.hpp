@@ -0,0 +1,548 @@
+#ifndef VIZZY_COMPILE_HPP
+#define VIZZY_COMPILE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include <vizzy/util.hpp>
+#include <vizzy/log.hpp>
+#include <vizzy/gl.hpp>
+#include <vizzy/cache.hpp>
+#include <vizzy/context.hpp>
+
+// Asynchronous compilation
+// INFO: https://registry.khronos.org/OpenGL/extensions/KHR/KHR_parallel_shader_compile.txt
+// Compiles and links are issued and then polled once per frame so the render loop never waits on the
+// compiler. With KHR_parallel_shader_compile the driver does the work on its own threads and we poll
+// GL_COMPLETION_STATUS_KHR, otherwise a worker thread with a shared context compiles and signals a
+// fence when the program is ready for the render thread.
+namespace vizzy::gl {
+	enum class CompileState {
+		Idle,
+		Compiling,  // Waiting on shaders (parallel).
+		Linking,  // Waiting on the program (parallel).
+		Worker,  // Handed to the worker thread.
+		Ready,
+		Failed,
+	};
+
+	namespace detail {
+		// Shared between the render thread and the worker.
+		struct CompileJob {
+			std::vector<std::pair<GLenum, std::string>> stages;
+			bool separable = false;
+
+			GLuint program = 0;
+			GLsync fence = nullptr;
+			std::string error;
+
+			std::atomic<bool> done = false;
+		};
+	}  // namespace detail
+
+	struct PendingProgram {
+		CompileState state = CompileState::Idle;
+
+		std::vector<std::pair<GLenum, std::string>> stages;  // Owned copies of the sources.
+		bool separable = false;
+
+		std::vector<GLuint> shaders;
+		GLuint program = 0;
+
+		std::filesystem::path cache_path;
+		vizzy::timepoint start;
+
+		std::shared_ptr<detail::CompileJob> job;
+		std::string error;
+	};
+
+	struct ShaderCompiler {
+		bool parallel = false;
+
+		// Fallback worker.
+		vizzy::SharedContext shared;
+		std::thread worker;
+
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::deque<std::shared_ptr<detail::CompileJob>> jobs;
+		bool stop = false;
+
+		// Joins the worker if `destroy_shader_compiler` wasn't reached, e.g. when `vizzy::die` unwinds
+		// past it.
+		~ShaderCompiler();
+	};
+
+	namespace detail {
+		// Unchecked queries, `get` dies on error which must not happen on the worker thread.
+		[[nodiscard]] inline GLint shader_param(GLuint shader, GLenum param) {
+			GLint v = 0;
+			glGetShaderiv(shader, param, &v);
+
+			return v;
+		}
+
+		[[nodiscard]] inline GLint program_param(GLuint program, GLenum param) {
+			GLint v = 0;
+			glGetProgramiv(program, param, &v);
+
+			return v;
+		}
+
+		[[nodiscard]] inline std::string shader_info_log(GLuint shader) {
+			std::string info;
+			info.resize(shader_param(shader, GL_INFO_LOG_LENGTH), '\0');
+			glGetShaderInfoLog(shader, static_cast<GLsizei>(info.size()), nullptr, info.data());
+
+			return info;
+		}
+
+		[[nodiscard]] inline std::string program_info_log(GLuint program) {
+			std::string info;
+			info.resize(program_param(program, GL_INFO_LOG_LENGTH), '\0');
+			glGetProgramInfoLog(program, static_cast<GLsizei>(info.size()), nullptr, info.data());
+
+			return info;
+		}
+
+		[[nodiscard]] inline GLuint compile_issue_shader(GLenum kind, const std::string& source) {
+			GLuint shader = glCreateShader(kind);
+
+			const GLchar* str = source.data();
+			GLint length = static_cast<GLint>(source.size());
+
+			glShaderSource(shader, 1, &str, &length);
+			glCompileShader(shader);
+
+			return shader;
+		}
+
+		// Attach, link and release the shaders. Status is checked separately.
+		[[nodiscard]] inline GLuint compile_issue_link(const std::vector<GLuint>& shaders, bool separable) {
+			GLuint program = glCreateProgram();
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			glProgramParameteri(program, GL_PROGRAM_SEPARABLE, separable ? GL_TRUE : GL_FALSE);
+
+			for (GLuint shader: shaders) {
+				glAttachShader(program, shader);
+				glDeleteShader(shader);
+			}
+
+			glLinkProgram(program);
+
+			return program;
+		}
+
+		// Compile and link on the calling thread without ever dying, for the worker.
+		inline void compile_job(CompileJob& job) {
+			std::vector<GLuint> shaders;
+
+			for (const auto& [kind, source]: job.stages) {
+				GLuint shader = compile_issue_shader(kind, source);
+
+				if (shader_param(shader, GL_COMPILE_STATUS) != GL_TRUE) {
+					job.error = shader_info_log(shader);
+
+					glDeleteShader(shader);
+
+					for (GLuint other: shaders) {
+						glDeleteShader(other);
+					}
+
+					return;
+				}
+
+				shaders.push_back(shader);
+			}
+
+			GLuint program = compile_issue_link(shaders, job.separable);
+
+			if (program_param(program, GL_LINK_STATUS) != GL_TRUE) {
+				job.error = program_info_log(program);
+				glDeleteProgram(program);
+
+				return;
+			}
+
+			job.program = program;
+		}
+
+		// Never dies, errors go back to the render thread through the job.
+		inline void compile_worker(ShaderCompiler& compiler) {
+			std::string failure;
+
+			if (not vizzy::shared_context_make_current(compiler.shared)) {
+				failure = "cannot make the compiler's shared context current";
+			}
+
+			while (true) {
+				std::shared_ptr<CompileJob> job;
+
+				{
+					std::unique_lock lock { compiler.mutex };
+					compiler.cv.wait(lock, [&] { return compiler.stop or not compiler.jobs.empty(); });
+
+					if (compiler.stop) {
+						break;
+					}
+
+					job = std::move(compiler.jobs.front());
+					compiler.jobs.pop_front();
+				}
+
+				if (not failure.empty()) {
+					job->error = failure;
+					job->done.store(true, std::memory_order_release);
+
+					continue;
+				}
+
+				compile_job(*job);
+
+				// Objects are only guaranteed complete for other contexts once this signals.
+				job->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				glFlush();
+
+				job->done.store(true, std::memory_order_release);
+			}
+
+			if (failure.empty()) {
+				vizzy::shared_context_release(compiler.shared);
+			}
+		}
+	}  // namespace detail
+
+	// Needs the context to be current on the calling thread.
+	inline void create_shader_compiler(
+		ShaderCompiler& compiler, const vizzy::Context& context, bool allow_parallel = true) {
+		VIZZY_FUNCTION();
+
+		if (allow_parallel and GLAD_GL_KHR_parallel_shader_compile) {
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);  // Let the driver decide.
+			compiler.parallel = true;
+
+			VIZZY_OKAY("using GL_KHR_parallel_shader_compile");
+			return;
+		}
+
+		compiler.shared = vizzy::create_shared_context(context);
+		compiler.worker = std::thread(detail::compile_worker, std::ref(compiler));
+
+		VIZZY_OKAY("using a shader compiler thread");
+	}
+
+	inline void destroy_shader_compiler(ShaderCompiler& compiler) {
+		if (not compiler.worker.joinable()) {
+			return;
+		}
+
+		{
+			std::lock_guard lock { compiler.mutex };
+			compiler.stop = true;
+		}
+
+		compiler.cv.notify_one();
+		compiler.worker.join();
+
+		vizzy::destroy_shared_context(compiler.shared);
+	}
+
+	inline ShaderCompiler::~ShaderCompiler() {
+		destroy_shader_compiler(*this);
+	}
+
+	// Starts building a program, poll it with `compile_swap`. Cache hits are ready immediately.
+	// Separable programs hold a subset of the stages and are bound with `glUseProgramStages`.
+	[[nodiscard]] inline PendingProgram compile_async(ShaderCompiler& compiler,
+		ProgramCache& cache,
+		const std::vector<ShaderSource>& stages,
+		bool separable = false) {
+		VIZZY_FUNCTION();
+
+		PendingProgram pending;
+		pending.start = vizzy::clock::now();
+		pending.separable = separable;
+
+		for (const auto& [kind, sources]: stages) {
+			std::string source;
+
+			for (auto sv: sources) {
+				source += sv;
+			}
+
+			pending.stages.emplace_back(kind, std::move(source));
+		}
+
+		// Hashing is streamed so the joined sources give the same key as `cached_program`.
+		std::vector<ShaderSource> joined;
+
+		for (const auto& [kind, source]: pending.stages) {
+			joined.push_back({ kind, { source } });
+		}
+
+		if (cache.enabled) {
+			pending.cache_path = detail::program_cache_path(cache, joined, separable);
+
+			if (GLuint program = detail::program_cache_load(cache, pending.cache_path); program != 0) {
+				cache.hits++;
+				cache.saved_ms -= std::chrono::duration<double, std::milli>(vizzy::clock::now() - pending.start).count();
+
+				pending.program = program;
+				pending.state = CompileState::Ready;
+
+				return pending;
+			}
+
+			cache.misses++;
+		}
+
+		if (compiler.parallel) {
+			for (const auto& [kind, source]: pending.stages) {
+				pending.shaders.push_back(detail::compile_issue_shader(kind, source));
+			}
+
+			pending.state = CompileState::Compiling;
+			return pending;
+		}
+
+		pending.job = std::make_shared<detail::CompileJob>();
+		pending.job->stages = pending.stages;
+		pending.job->separable = separable;
+
+		{
+			std::lock_guard lock { compiler.mutex };
+			compiler.jobs.push_back(pending.job);
+		}
+
+		compiler.cv.notify_one();
+
+		pending.state = CompileState::Worker;
+		return pending;
+	}
+
+	namespace detail {
+		inline void compile_fail(PendingProgram& pending, std::string error) {
+			pending.error = std::move(error);
+			pending.state = CompileState::Failed;
+		}
+
+		// Never blocks. Returns true once the program is ready or has failed.
+		[[nodiscard]] inline bool compile_poll(PendingProgram& pending) {
+			switch (pending.state) {
+				case CompileState::Idle:
+				case CompileState::Ready:
+				case CompileState::Failed: return pending.state != CompileState::Idle;
+
+				case CompileState::Compiling: {
+					for (GLuint shader: pending.shaders) {
+						if (shader_param(shader, GL_COMPLETION_STATUS_KHR) != GL_TRUE) {
+							return false;
+						}
+					}
+
+					for (GLuint shader: pending.shaders) {
+						if (shader_param(shader, GL_COMPILE_STATUS) != GL_TRUE) {
+							std::string error = shader_info_log(shader);
+
+							for (GLuint other: pending.shaders) {
+								glDeleteShader(other);
+							}
+
+							pending.shaders.clear();
+							compile_fail(pending, std::move(error));
+
+							return true;
+						}
+					}
+
+					pending.program = compile_issue_link(pending.shaders, pending.separable);
+					pending.shaders.clear();
+					pending.state = CompileState::Linking;
+
+					return false;
+				}
+
+				case CompileState::Linking: {
+					if (program_param(pending.program, GL_COMPLETION_STATUS_KHR) != GL_TRUE) {
+						return false;
+					}
+
+					if (program_param(pending.program, GL_LINK_STATUS) != GL_TRUE) {
+						std::string error = program_info_log(pending.program);
+
+						glDeleteProgram(pending.program);
+						pending.program = 0;
+
+						compile_fail(pending, std::move(error));
+						return true;
+					}
+
+					pending.state = CompileState::Ready;
+					return true;
+				}
+
+				case CompileState::Worker: {
+					CompileJob& job = *pending.job;
+
+					if (not job.done.load(std::memory_order_acquire)) {
+						return false;
+					}
+
+					// Jobs the worker couldn't run have no fence.
+					if (job.fence != nullptr) {
+						if (glClientWaitSync(job.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+							return false;
+						}
+
+						glDeleteSync(job.fence);
+					}
+
+					pending.program = job.program;
+					std::string error = std::move(job.error);
+
+					pending.job.reset();
+
+					if (pending.program == 0) {
+						compile_fail(pending, std::move(error));
+						return true;
+					}
+
+					pending.state = CompileState::Ready;
+					return true;
+				}
+			}
+
+			VIZZY_UNREACHABLE();
+		}
+	}  // namespace detail
+
+	// Polls `pending` and once it's linked replaces `program` with it, between frames so a draw never
+	// sees a half built program. A failed build keeps the old program, unless there isn't one.
+	// Returns true when `program` changed.
+	inline bool compile_swap(ProgramCache& cache, PendingProgram& pending, Program& program) {
+		if (pending.state == CompileState::Idle or not detail::compile_poll(pending)) {
+			return false;
+		}
+
+		std::chrono::duration<double, std::milli> elapsed = vizzy::clock::now() - pending.start;
+
+		if (pending.state == CompileState::Failed) {
+			pending.state = CompileState::Idle;
+
+			if (program.id == 0) {
+				vizzy::die("shader build failed! GL: {}", pending.error);
+			}
+
+			VIZZY_ERROR("shader build failed, keeping previous program! GL: {}", pending.error);
+			return false;
+		}
+
+		if (cache.enabled and not pending.cache_path.empty() and not std::filesystem::exists(pending.cache_path)) {
+			detail::program_cache_store(pending.cache_path, pending.program, static_cast<float>(elapsed.count()));
+		}
+
+		// The old program may still be in use by frames in flight, dropping its handle defers the delete.
+		program = Program { ProgramHandle { pending.program }, reflect_uniforms(pending.program) };
+
+		pending = {};
+
+		VIZZY_OKAY("program ({}) ready after {:.2f}ms", program.id, elapsed.count());
+		return true;
+	}
+
+	// Stage pipelines
+	// Each stage is its own separable program so a change to one file relinks only that stage, the
+	// others keep their programs and the pipeline object stays bound.
+
+	struct PipelineStage {
+		GLenum kind = GL_NONE;
+		GLbitfield bit = 0;
+
+		std::filesystem::path path;  // Empty for built-in sources.
+		std::string source;
+
+		bool stale = true;  // `source` changed since the last build was started.
+		vizzy::timepoint changed;
+
+		Program program;
+		PendingProgram pending;
+	};
+
+	// `path` is only kept for reloading, `source` is what gets built.
+	[[nodiscard]] inline PipelineStage create_pipeline_stage(
+		GLenum kind, std::filesystem::path path, std::string source) {
+		PipelineStage stage;
+
+		stage.kind = kind;
+		stage.bit = detail::shader_type_to_bitfield(static_cast<GLint>(kind));
+		stage.path = std::move(path);
+		stage.source = std::move(source);
+
+		return stage;
+	}
+
+	// Starts a build of `stage` if its source changed and no build is in flight. A change that arrives
+	// mid-build is picked up by the next call once the current build has been swapped in.
+	inline void stage_build(ShaderCompiler& compiler,
+		ProgramCache& cache,
+		PipelineStage& stage,
+		const std::vector<std::string_view>& prefix) {
+		if (not stage.stale or stage.pending.state != CompileState::Idle) {
+			return;
+		}
+
+		std::vector<std::string_view> sources = prefix;
+		sources.push_back(stage.source);
+
+		stage.pending = compile_async(compiler, cache, { { stage.kind, sources } }, true);
+		stage.stale = false;
+	}
+
+	// `compile_swap` for one stage, rebinding it when `pipeline` already exists.
+	inline bool stage_swap(ProgramCache& cache, PipelineStage& stage, GLuint pipeline) {
+		if (not compile_swap(cache, stage.pending, stage.program)) {
+			return false;
+		}
+
+		if (pipeline == 0) {
+			return true;
+		}
+
+		call(glUseProgramStages, pipeline, stage.bit, stage.program.id);
+
+		// The new stage may no longer match the interface of the others.
+		glValidateProgramPipeline(pipeline);
+
+		if (gl_get_pipeline(pipeline, GL_VALIDATE_STATUS) != GL_TRUE) {
+			std::string info;
+			info.resize(gl_get_pipeline(pipeline, GL_INFO_LOG_LENGTH), '\0');
+			call(glGetProgramPipelineInfoLog, pipeline, static_cast<GLsizei>(info.size()), nullptr, info.data());
+
+			VIZZY_WARN("pipeline ({}) failed validation! GL: {}", pipeline, info);
+		}
+
+		return true;
+	}
+
+	// For callers that can't continue without the program.
+	inline void compile_wait(ProgramCache& cache, PendingProgram& pending, Program& program) {
+		while (pending.state != CompileState::Idle) {
+			if (compile_swap(cache, pending, program)) {
+				return;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds { 1 });
+		}
+	}
+}  // namespace vizzy::gl
+
+#endif
@@ -0,0 +1,454 @@
+#ifndef VIZZY_CONTEXT_HPP
+#define VIZZY_CONTEXT_HPP
+
+#include <chrono>
+#include <optional>
+#include <string_view>
+
+#include <glad/gl.h>
+#include <SDL2/SDL.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <vizzy/util.hpp>
+#include <vizzy/log.hpp>
+#include <vizzy/offline.hpp>
+
+// Contexts
+// Either an SDL window or a headless EGL context that draws into an offscreen target. Everything
+// past creation only sees `context_framebuffer` and `context_size` so the two are interchangeable.
+namespace vizzy {
+	enum class ContextKind {
+		Window,
+		Headless,
+	};
+
+	struct ContextConfig {
+		std::string_view title;
+
+		int width = 0;
+		int height = 0;
+
+		int gl_major = 0;
+		int gl_minor = 0;
+
+		bool debug = true;
+	};
+
+	struct Context {
+		ContextKind kind = ContextKind::Window;
+		ContextConfig config;
+
+		SDL_Window* window = nullptr;
+		SDL_GLContext gl = nullptr;
+
+		EGLDisplay display = EGL_NO_DISPLAY;
+		EGLSurface surface = EGL_NO_SURFACE;  // Only when the display can't go surfaceless.
+		EGLContext egl = EGL_NO_CONTEXT;
+		EGLConfig egl_config = nullptr;
+
+		vizzy::gl::Target target;  // Headless only.
+	};
+
+	// A second context sharing objects with a `Context`, for use on another thread.
+	struct SharedContext {
+		ContextKind kind = ContextKind::Window;
+
+		SDL_Window* window = nullptr;
+		SDL_GLContext gl = nullptr;
+
+		EGLDisplay display = EGL_NO_DISPLAY;
+		EGLSurface surface = EGL_NO_SURFACE;
+		EGLContext egl = EGL_NO_CONTEXT;
+	};
+
+	namespace detail {
+		inline void context_load_gl(GLADloadfunc load) {
+			if (int v = gladLoadGL(load); v != 0) {
+				VIZZY_OKAY("OpenGL {}.{}", GLAD_VERSION_MAJOR(v), GLAD_VERSION_MINOR(v));
+			}
+
+			else {
+				vizzy::die("gladLoadGL failed!");
+			}
+
+			VIZZY_DEBUG("vendor = {}, renderer = {}",
+				reinterpret_cast<const char*>(glGetString(GL_VENDOR)),
+				reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+		}
+
+		[[nodiscard]] inline EGLContext egl_create_context(
+			EGLDisplay display, EGLConfig egl_config, EGLContext share, const ContextConfig& config) {
+			const EGLint attribs[] = {
+				EGL_CONTEXT_MAJOR_VERSION,
+				config.gl_major,
+				EGL_CONTEXT_MINOR_VERSION,
+				config.gl_minor,
+				EGL_CONTEXT_OPENGL_PROFILE_MASK,
+				EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+				EGL_CONTEXT_OPENGL_DEBUG,
+				config.debug ? EGL_TRUE : EGL_FALSE,
+				EGL_NONE,
+			};
+
+			EGLContext egl = eglCreateContext(display, egl_config, share, attribs);
+
+			if (egl == EGL_NO_CONTEXT) {
+				vizzy::die("eglCreateContext failed! EGL: {:#x}", eglGetError());
+			}
+
+			return egl;
+		}
+
+		[[nodiscard]] inline EGLSurface egl_create_pbuffer(EGLDisplay display, EGLConfig egl_config) {
+			const EGLint attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+			EGLSurface surface = eglCreatePbufferSurface(display, egl_config, attribs);
+
+			if (surface == EGL_NO_SURFACE) {
+				vizzy::die("eglCreatePbufferSurface failed! EGL: {:#x}", eglGetError());
+			}
+
+			return surface;
+		}
+
+		[[nodiscard]] inline bool egl_has_extension(const char* extensions, std::string_view name) {
+			if (extensions == nullptr) {
+				return false;
+			}
+
+			std::string_view list { extensions };
+
+			for (size_t pos = list.find(name); pos != std::string_view::npos; pos = list.find(name, pos + 1)) {
+				bool starts = pos == 0 or list[pos - 1] == ' ';
+				bool ends = pos + name.size() == list.size() or list[pos + name.size()] == ' ';
+
+				if (starts and ends) {
+					return true;
+				}
+			}
+
+			return false;
+		}
+	}  // namespace detail
+
+	[[nodiscard]] inline Context create_window_context(const ContextConfig& config) {
+		VIZZY_FUNCTION();
+
+		if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
+			vizzy::die("SDL_Init failed!");
+		}
+
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, config.gl_major);
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, config.gl_minor);
+
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+		SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
+		SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 1);
+
+		if (config.debug) {
+			SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+		}
+
+		Context context;
+		context.kind = ContextKind::Window;
+		context.config = config;
+
+		context.window = SDL_CreateWindow(std::string { config.title }.c_str(),
+			SDL_WINDOWPOS_UNDEFINED,
+			SDL_WINDOWPOS_UNDEFINED,
+			config.width,
+			config.height,
+			SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+
+		if (context.window == nullptr) {
+			vizzy::die("SDL_CreateWindow failed! SDL: {}", SDL_GetError());
+		}
+
+		context.gl = SDL_GL_CreateContext(context.window);
+
+		if (context.gl == nullptr) {
+			vizzy::die("SDL_GL_CreateContext failed! SDL: {}", SDL_GetError());
+		}
+
+		detail::context_load_gl((GLADloadfunc)SDL_GL_GetProcAddress);
+
+		return context;
+	}
+
+	// INFO: https://registry.khronos.org/EGL/extensions/MESA/EGL_MESA_platform_surfaceless.txt
+	// Prefers Mesa's surfaceless platform which needs no display server at all (llvmpipe on a CI box),
+	// otherwise uses the default display with a throwaway pbuffer.
+	[[nodiscard]] inline Context create_headless_context(const ContextConfig& config) {
+		VIZZY_FUNCTION();
+
+		Context context;
+		context.kind = ContextKind::Headless;
+		context.config = config;
+
+		const char* client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+		if (detail::egl_has_extension(client_extensions, "EGL_MESA_platform_surfaceless") and
+			detail::egl_has_extension(client_extensions, "EGL_EXT_platform_base")) {
+			auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+				eglGetProcAddress("eglGetPlatformDisplayEXT"));
+
+			context.display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+			VIZZY_DEBUG("using EGL_MESA_platform_surfaceless");
+		}
+
+		if (context.display == EGL_NO_DISPLAY) {
+			context.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		}
+
+		if (context.display == EGL_NO_DISPLAY) {
+			vizzy::die("no EGL display available");
+		}
+
+		EGLint major, minor;
+
+		if (eglInitialize(context.display, &major, &minor) != EGL_TRUE) {
+			vizzy::die("eglInitialize failed! EGL: {:#x}", eglGetError());
+		}
+
+		VIZZY_DEBUG("EGL {}.{} ({})", major, minor, eglQueryString(context.display, EGL_VENDOR));
+
+		if (eglBindAPI(EGL_OPENGL_API) != EGL_TRUE) {
+			vizzy::die("eglBindAPI failed! EGL: {:#x}", eglGetError());
+		}
+
+		// Colour format doesn't matter since we never draw to the surface.
+		const EGLint config_attribs[] = {
+			EGL_SURFACE_TYPE,
+			EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE,
+			EGL_OPENGL_BIT,
+			EGL_NONE,
+		};
+
+		EGLint count = 0;
+
+		if (eglChooseConfig(context.display, config_attribs, &context.egl_config, 1, &count) != EGL_TRUE or count == 0) {
+			vizzy::die("eglChooseConfig found no OpenGL config! EGL: {:#x}", eglGetError());
+		}
+
+		context.egl = detail::egl_create_context(context.display, context.egl_config, EGL_NO_CONTEXT, config);
+
+		if (not detail::egl_has_extension(eglQueryString(context.display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+			context.surface = detail::egl_create_pbuffer(context.display, context.egl_config);
+		}
+
+		if (eglMakeCurrent(context.display, context.surface, context.surface, context.egl) != EGL_TRUE) {
+			vizzy::die("eglMakeCurrent failed! EGL: {:#x}", eglGetError());
+		}
+
+		detail::context_load_gl((GLADloadfunc)eglGetProcAddress);
+
+		context.target = vizzy::gl::create_target(config.width, config.height);
+
+		return context;
+	}
+
+	inline void destroy_context(Context& context) {
+		switch (context.kind) {
+			case ContextKind::Window: {
+				SDL_GL_DeleteContext(context.gl);
+				SDL_DestroyWindow(context.window);
+
+				SDL_Quit();
+			} break;
+
+			case ContextKind::Headless: {
+				vizzy::gl::destroy_target(context.target);
+
+				// Dropping the target only queues its objects, and the queue must be empty once the
+				// context they belong to is gone.
+				vizzy::gl::deletion_flush();
+
+				eglMakeCurrent(context.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+				if (context.surface != EGL_NO_SURFACE) {
+					eglDestroySurface(context.display, context.surface);
+				}
+
+				eglDestroyContext(context.display, context.egl);
+				eglTerminate(context.display);
+			} break;
+		}
+
+		context = {};
+	}
+
+	// Must be called on the thread that owns `context`, which stays current. Make the result current on
+	// the other thread with `shared_context_make_current`.
+	[[nodiscard]] inline SharedContext create_shared_context(const Context& context) {
+		VIZZY_FUNCTION();
+
+		SharedContext shared;
+		shared.kind = context.kind;
+
+		switch (context.kind) {
+			case ContextKind::Window: {
+				SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+
+				shared.window = context.window;
+				shared.gl = SDL_GL_CreateContext(context.window);
+
+				SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+
+				if (shared.gl == nullptr) {
+					vizzy::die("SDL_GL_CreateContext failed! SDL: {}", SDL_GetError());
+				}
+
+				// Creating a context makes it current.
+				SDL_GL_MakeCurrent(context.window, context.gl);
+			} break;
+
+			case ContextKind::Headless: {
+				shared.display = context.display;
+				shared.egl = detail::egl_create_context(context.display, context.egl_config, context.egl, context.config);
+
+				if (context.surface != EGL_NO_SURFACE) {
+					shared.surface = detail::egl_create_pbuffer(context.display, context.egl_config);
+				}
+			} break;
+		}
+
+		return shared;
+	}
+
+	// Returns false instead of dying, the other thread is usually not the one that can report it.
+	[[nodiscard]] inline bool shared_context_make_current(const SharedContext& shared) {
+		return shared.kind == ContextKind::Window ?
+			SDL_GL_MakeCurrent(shared.window, shared.gl) == 0 :
+			eglMakeCurrent(shared.display, shared.surface, shared.surface, shared.egl) == EGL_TRUE;
+	}
+
+	// Call on the thread it was made current on, after it's done with GL.
+	inline void shared_context_release(const SharedContext& shared) {
+		if (shared.kind == ContextKind::Window) {
+			SDL_GL_MakeCurrent(shared.window, nullptr);
+		}
+
+		else {
+			eglMakeCurrent(shared.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		}
+	}
+
+	inline void destroy_shared_context(SharedContext& shared) {
+		if (shared.kind == ContextKind::Window) {
+			SDL_GL_DeleteContext(shared.gl);
+		}
+
+		else {
+			if (shared.surface != EGL_NO_SURFACE) {
+				eglDestroySurface(shared.display, shared.surface);
+			}
+
+			eglDestroyContext(shared.display, shared.egl);
+		}
+
+		shared = {};
+	}
+
+	// Where frames meant for the screen should be drawn.
+	[[nodiscard]] inline GLuint context_framebuffer(const Context& context) {
+		return context.kind == ContextKind::Headless ? context.target.framebuffer : 0;
+	}
+
+	inline void context_size(const Context& context, int& width, int& height) {
+		if (context.kind == ContextKind::Headless) {
+			width = context.target.width;
+			height = context.target.height;
+			return;
+		}
+
+		SDL_GL_GetDrawableSize(context.window, &width, &height);
+	}
+
+	// INFO: https://wiki.libsdl.org/SDL2/SDL_GL_SetSwapInterval
+	// Adaptive vsync waits for vblank like `On` unless the frame is already late, in which case it's
+	// shown straight away and tears instead of waiting another whole interval.
+	enum class Vsync {
+		Off,
+		On,
+		Adaptive,
+	};
+
+	[[nodiscard]] inline std::optional<Vsync> vsync_from_str(std::string_view sv) {
+		if (sv == "off") {
+			return Vsync::Off;
+		}
+
+		if (sv == "on") {
+			return Vsync::On;
+		}
+
+		if (sv == "adaptive") {
+			return Vsync::Adaptive;
+		}
+
+		return std::nullopt;
+	}
+
+	[[nodiscard]] inline std::string_view vsync_str(Vsync vsync) {
+		switch (vsync) {
+			case Vsync::Off: return "off";
+			case Vsync::On: return "on";
+			case Vsync::Adaptive: return "adaptive";
+		}
+
+		return "unknown";
+	}
+
+	// Returns the mode that was actually set, adaptive falls back to on where it isn't supported.
+	// Headless contexts never wait.
+	inline Vsync context_vsync(const Context& context, Vsync vsync) {
+		if (context.kind == ContextKind::Headless) {
+			return Vsync::Off;
+		}
+
+		if (vsync == Vsync::Adaptive) {
+			if (SDL_GL_SetSwapInterval(-1) == 0) {
+				return vsync;
+			}
+
+			VIZZY_WARN("adaptive vsync unsupported, using vsync! SDL: {}", SDL_GetError());
+			vsync = Vsync::On;
+		}
+
+		if (SDL_GL_SetSwapInterval(vsync == Vsync::On ? 1 : 0) != 0) {
+			VIZZY_WARN("cannot set vsync to {}! SDL: {}", vsync_str(vsync), SDL_GetError());
+			return Vsync::Off;
+		}
+
+		return vsync;
+	}
+
+	// Refresh interval reported for the display the window is on, if there is one.
+	[[nodiscard]] inline std::optional<vizzy::clock::duration> context_refresh_interval(const Context& context) {
+		if (context.kind == ContextKind::Headless) {
+			return std::nullopt;
+		}
+
+		SDL_DisplayMode mode;
+
+		if (SDL_GetWindowDisplayMode(context.window, &mode) != 0 or mode.refresh_rate <= 0) {
+			return std::nullopt;
+		}
+
+		return std::chrono::duration_cast<vizzy::clock::duration>(
+			std::chrono::duration<double> { 1.0 / static_cast<double>(mode.refresh_rate) });
+	}
+
+	// Nothing is presented headless, flushing keeps the GPU busy the same way a swap would.
+	inline void context_swap(const Context& context) {
+		if (context.kind == ContextKind::Headless) {
+			glFlush();
+			return;
+		}
+
+		SDL_GL_SwapWindow(context.window);
+	}
+}  // namespace vizzy
+
+#endif
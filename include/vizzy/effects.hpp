@@ -0,0 +1,406 @@
+#ifndef VIZZY_EFFECTS_HPP
+#define VIZZY_EFFECTS_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include <vizzy/util.hpp>
+#include <vizzy/log.hpp>
+#include <vizzy/gl.hpp>
+#include <vizzy/cache.hpp>
+
+// Compute effects
+// INFO: https://www.khronos.org/opengl/wiki/Memory_Model#Incoherent_memory_access
+// Each effect is one or more compute dispatches that load from the image at binding 0 and store to the
+// image at binding 1, a chain ping-pongs between two images and its last dispatch writes straight into
+// the destination. Effect bodies only go through `effect_load`/`effect_store` so the same source also
+// builds as a fragment shader for comparison. Image stores are incoherent, so a barrier is issued
+// between dispatches for image loads and once at the end for however the result is consumed.
+namespace vizzy::gl {
+	inline constexpr GLenum effect_format = GL_RGBA16F;
+
+	struct EffectDesc {
+		const char* name;
+		std::string_view source;  // Defines `void effect(ivec2 p)`.
+
+		size_t steps = 1;  // Dispatches, each compiled with its own `STEP`.
+		bool history = false;  // Persistent image at binding 2.
+	};
+
+	inline constexpr std::string_view effect_blur = R"(
+		const float weights[5] = float[](0.227027, 0.1945946, 0.1216216, 0.054054, 0.016216);
+
+		void effect(ivec2 p) {
+			ivec2 axis = STEP == 0 ? ivec2(1, 0) : ivec2(0, 1);
+			vec4 sum = effect_load(p) * weights[0];
+
+			for (int i = 1; i < 5; ++i) {
+				sum += effect_load(p + axis * i) * weights[i];
+				sum += effect_load(p - axis * i) * weights[i];
+			}
+
+			effect_store(p, sum);
+		}
+	)";
+
+	inline constexpr std::string_view effect_feedback = R"(
+		layout (binding = 2, rgba16f) uniform image2D history;
+
+		uniform float decay = 0.92;
+
+		void effect(ivec2 p) {
+			vec4 c = max(effect_load(p), imageLoad(history, p) * decay);
+
+			imageStore(history, p, c);
+			effect_store(p, c);
+		}
+	)";
+
+	inline constexpr std::string_view effect_grade = R"(
+		uniform vec3 lift = vec3(0.02, 0.0, 0.04);
+		uniform vec3 gamma = vec3(1.0, 1.0, 0.95);
+		uniform vec3 gain = vec3(1.05, 1.0, 1.0);
+		uniform float saturation = 1.15;
+
+		void effect(ivec2 p) {
+			vec4 c = effect_load(p);
+
+			vec3 g = pow(max(c.rgb * gain + lift * (1.0 - c.rgb), 0.0), 1.0 / gamma);
+			float l = dot(g, vec3(0.2126, 0.7152, 0.0722));
+
+			effect_store(p, vec4(mix(vec3(l), g, saturation), c.a));
+		}
+	)";
+
+	// Single pass, a sparse 5x5 kernel over the bright parts is close enough for a glow.
+	inline constexpr std::string_view effect_bloom = R"(
+		uniform float threshold = 0.8;
+		uniform float intensity = 0.6;
+		uniform int spacing = 6;
+
+		void effect(ivec2 p) {
+			vec3 glow = vec3(0.0);
+			float total = 0.0;
+
+			for (int y = -2; y <= 2; ++y) {
+				for (int x = -2; x <= 2; ++x) {
+					float w = exp(-float(x * x + y * y) / 4.0);
+
+					glow += max(effect_load(p + ivec2(x, y) * spacing).rgb - threshold, 0.0) * w;
+					total += w;
+				}
+			}
+
+			vec4 c = effect_load(p);
+			effect_store(p, vec4(c.rgb + glow / total * intensity, c.a));
+		}
+	)";
+
+	inline constexpr std::array effect_descs = {
+		EffectDesc { "blur", effect_blur, 2, false },
+		EffectDesc { "feedback", effect_feedback, 1, true },
+		EffectDesc { "grade", effect_grade, 1, false },
+		EffectDesc { "bloom", effect_bloom, 1, false },
+	};
+
+	[[nodiscard]] inline const EffectDesc& find_effect(std::string_view name) {
+		auto it = std::find_if(effect_descs.begin(), effect_descs.end(), [&](const auto& desc) {
+			return desc.name == name;
+		});
+
+		if (it == effect_descs.end()) {
+			vizzy::die("unknown effect '{}'", name);
+		}
+
+		return *it;
+	}
+
+	struct Effect {
+		EffectDesc desc;
+		std::vector<Program> steps;
+
+		std::array<GLuint, 2> local { 16, 16 };  // Work group size.
+		TextureHandle history {};
+	};
+
+	struct EffectChain {
+		std::vector<Effect> effects;
+		std::array<TextureHandle, 2> images {};  // Intermediate results.
+
+		int width = 0;
+		int height = 0;
+	};
+
+	namespace detail {
+		inline constexpr std::string_view effect_compute_prelude = R"(
+			layout (local_size_x = LOCAL_X, local_size_y = LOCAL_Y) in;
+
+			layout (binding = 0, rgba16f) uniform readonly image2D src;
+			layout (binding = 1, rgba16f) uniform writeonly image2D dst;
+
+			ivec2 effect_size() { return imageSize(dst); }
+			vec4 effect_load(ivec2 p) { return imageLoad(src, clamp(p, ivec2(0), effect_size() - 1)); }
+			void effect_store(ivec2 p, vec4 c) { imageStore(dst, p, c); }
+
+			void effect(ivec2 p);
+
+			void main() {
+				ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+
+				if (all(lessThan(p, effect_size()))) {
+					effect(p);
+				}
+			}
+		)";
+
+		inline constexpr std::string_view effect_fragment_prelude = R"(
+			layout (binding = 0) uniform sampler2D src;
+			layout (location = 0) out vec4 effect_colour;
+
+			ivec2 effect_size() { return textureSize(src, 0); }
+			vec4 effect_load(ivec2 p) { return texelFetch(src, clamp(p, ivec2(0), effect_size() - 1), 0); }
+			void effect_store(ivec2 p, vec4 c) { effect_colour = c; }
+
+			void effect(ivec2 p);
+
+			void main() {
+				effect(ivec2(gl_FragCoord.xy));
+			}
+		)";
+
+		[[nodiscard]] inline Program effect_compute_program(
+			ProgramCache& cache, const EffectDesc& desc, size_t step, std::array<GLuint, 2> local) {
+			std::string defines = fmt::format("#define LOCAL_X {}\n#define LOCAL_Y {}\n#define STEP {}\n", local[0], local[1], step);
+
+			return cached_program(cache,
+				{
+					{ GL_COMPUTE_SHADER, { VIZZY_GLSL_VERSION, defines, effect_compute_prelude, desc.source } },
+				});
+		}
+
+		[[nodiscard]] inline Program effect_fragment_program(ProgramCache& cache, const EffectDesc& desc, size_t step) {
+			std::string defines = fmt::format("#define STEP {}\n", step);
+
+			return cached_program(cache,
+				{
+					{ GL_VERTEX_SHADER, { VIZZY_GLSL_VERSION, fullscreen_vert } },
+					{ GL_FRAGMENT_SHADER, { VIZZY_GLSL_VERSION, defines, effect_fragment_prelude, desc.source } },
+				});
+		}
+
+		[[nodiscard]] inline TextureHandle effect_image(int width, int height) {
+			GLuint texture;
+			call(glCreateTextures, GL_TEXTURE_2D, 1, &texture);
+			call(glTextureStorage2D, texture, 1, effect_format, width, height);
+
+			call(glTextureParameteri, texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			call(glTextureParameteri, texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			call(glTextureParameteri, texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			call(glTextureParameteri, texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+			return TextureHandle { texture };
+		}
+
+		inline void effect_dispatch(const Effect& effect, size_t step, GLuint src, GLuint dst, int width, int height) {
+			glUseProgram(effect.steps[step].id);
+
+			glBindImageTexture(0, src, 0, GL_FALSE, 0, GL_READ_ONLY, effect_format);
+			glBindImageTexture(1, dst, 0, GL_FALSE, 0, GL_WRITE_ONLY, effect_format);
+
+			if (effect.history != 0) {
+				glBindImageTexture(2, effect.history, 0, GL_FALSE, 0, GL_READ_WRITE, effect_format);
+			}
+
+			glDispatchCompute((static_cast<GLuint>(width) + effect.local[0] - 1) / effect.local[0],
+				(static_cast<GLuint>(height) + effect.local[1] - 1) / effect.local[1],
+				1);
+		}
+
+		// Wall time of `fn` with the GPU drained on both sides. Timer queries would be more precise, but
+		// software drivers run compute work outside of them.
+		template <typename F>
+		[[nodiscard]] inline double effect_time_ms(F&& fn) {
+			glFinish();
+
+			auto start = vizzy::clock::now();
+
+			fn();
+			glFinish();
+
+			return std::chrono::duration<double, std::milli>(vizzy::clock::now() - start).count();
+		}
+	}  // namespace detail
+
+	inline void effect_chain_resize(EffectChain& chain, int width, int height) {
+		if (chain.width == width and chain.height == height) {
+			return;
+		}
+
+		// Replaced images are deleted once the frames using them are done.
+		for (auto& image: chain.images) {
+			image = detail::effect_image(width, height);
+		}
+
+		for (auto& effect: chain.effects) {
+			if (not effect.desc.history) {
+				continue;
+			}
+
+			effect.history = detail::effect_image(width, height);
+			call(glClearTexImage, effect.history, 0, GL_RGBA, GL_FLOAT, nullptr);
+		}
+
+		chain.width = width;
+		chain.height = height;
+	}
+
+	// Picks the fastest work group size for `effect` at the chain's current size. Every candidate is a
+	// separate program since the size is baked into the shader.
+	inline void effect_tune(ProgramCache& cache, EffectChain& chain, Effect& effect, size_t iterations = 8) {
+		VIZZY_FUNCTION();
+
+		constexpr std::array<std::array<GLuint, 2>, 6> candidates = { {
+			{ 8, 8 },
+			{ 16, 8 },
+			{ 16, 16 },
+			{ 32, 8 },
+			{ 32, 4 },
+			{ 64, 1 },
+		} };
+
+		double best = std::numeric_limits<double>::max();
+
+		std::vector<Program> best_steps;
+		std::array<GLuint, 2> best_local = effect.local;
+
+		// Candidates are swapped into `effect` so they run with its history, losers are dropped.
+		for (auto local: candidates) {
+			effect.local = local;
+			effect.steps.clear();
+
+			for (size_t step = 0; step != effect.desc.steps; ++step) {
+				effect.steps.push_back(detail::effect_compute_program(cache, effect.desc, step, local));
+			}
+
+			double fastest = std::numeric_limits<double>::max();
+
+			// The first run is a warm up so first-use costs don't count.
+			for (size_t k = 0; k != iterations + 1; ++k) {
+				double ms = detail::effect_time_ms([&] {
+					for (size_t step = 0; step != effect.steps.size(); ++step) {
+						detail::effect_dispatch(effect,
+							step,
+							chain.images[step & 1],
+							chain.images[(step + 1) & 1],
+							chain.width,
+							chain.height);
+
+						glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+					}
+				});
+
+				if (k != 0) {
+					fastest = std::min(fastest, ms);
+				}
+			}
+
+			VIZZY_DEBUG("effect '{}': {}x{} = {:.3f}ms", effect.desc.name, local[0], local[1], fastest);
+
+			if (fastest < best) {
+				best = fastest;
+				best_steps = std::move(effect.steps);
+				best_local = local;
+			}
+		}
+
+		effect.steps = std::move(best_steps);
+		effect.local = best_local;
+
+		VIZZY_OKAY("effect '{}': {}x{} work groups, {:.3f}ms at {}x{}",
+			effect.desc.name,
+			effect.local[0],
+			effect.local[1],
+			best,
+			chain.width,
+			chain.height);
+	}
+
+	// Effects run in the order given. With `tune` each one is timed over a few work group sizes.
+	[[nodiscard]] inline EffectChain create_effect_chain(
+		ProgramCache& cache, const std::vector<std::string_view>& names, int width, int height, bool tune = true) {
+		VIZZY_FUNCTION();
+
+		EffectChain chain;
+
+		for (auto name: names) {
+			Effect effect;
+			effect.desc = find_effect(name);
+
+			for (size_t step = 0; step != effect.desc.steps; ++step) {
+				effect.steps.push_back(detail::effect_compute_program(cache, effect.desc, step, effect.local));
+			}
+
+			chain.effects.push_back(std::move(effect));
+		}
+
+		effect_chain_resize(chain, width, height);
+
+		if (tune) {
+			for (auto& effect: chain.effects) {
+				effect_tune(cache, chain, effect);
+			}
+		}
+
+		VIZZY_DEBUG("effects = {}", names);
+
+		return chain;
+	}
+
+	// Runs every effect from `input` into `output`, both `effect_format` and the chain's size.
+	// `consumer` is the barrier for however `output` is used next, e.g. GL_TEXTURE_FETCH_BARRIER_BIT
+	// when it's sampled.
+	inline void effect_chain_run(const EffectChain& chain, GLuint input, GLuint output, GLbitfield consumer) {
+		size_t total = 0;
+		bool history = false;
+
+		for (const auto& effect: chain.effects) {
+			total += effect.steps.size();
+			history = history or effect.history != 0;
+		}
+
+		GLuint src = input;
+		size_t n = 0;
+
+		for (const auto& effect: chain.effects) {
+			for (size_t step = 0; step != effect.steps.size(); ++step, ++n) {
+				GLuint dst = n + 1 == total ? output : chain.images[n & 1];
+
+				detail::effect_dispatch(effect, step, src, dst, chain.width, chain.height);
+
+				// The next dispatch loads what this one stored.
+				if (n + 1 != total) {
+					glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+				}
+
+				src = dst;
+			}
+		}
+
+		// History is loaded again next frame.
+		glMemoryBarrier(consumer | (history ? GL_SHADER_IMAGE_ACCESS_BARRIER_BIT : 0));
+	}
+
+	inline void destroy_effect_chain(EffectChain& chain) {
+		chain = {};
+	}
+}  // namespace vizzy::gl
+
+#endif
@@ -3,18 +3,10 @@
 
 #include <chrono>
 #include <functional>
-
-#include <libremidi/message.hpp>
-#include <glad/gl.h>
+#include <optional>
 
 #include <vizzy/log.hpp>
-
-// Time
-namespace vizzy {
-	using clock = std::chrono::steady_clock;
-	using timeunit = std::chrono::milliseconds;
-	using timepoint = std::chrono::time_point<clock>;
-}
+#include <vizzy/midi.hpp>
 
 // Easing functions
 namespace vizzy {
@@ -40,7 +32,10 @@ namespace vizzy {
 	struct Envelope {
 		std::string_view name;
 
-		std::function<bool(libremidi::message)> pattern;
+		// Messages that trigger the envelope. `match` is routed through a lookup table, `pattern` is
+		// an arbitrary predicate offered every message and is only used when there is no match.
+		std::optional<vizzy::MidiMatch> match;
+		std::function<bool(const vizzy::MidiEvent&)> pattern;
 		std::vector<Segment> segments;
 
 		vizzy::timepoint trigger = vizzy::timepoint::max();
@@ -135,6 +130,11 @@ namespace vizzy {
 			env.current_amplitude = linear(amp, end_amp, normalised_time);
 		}
 
+		// Triggered ahead of time, hold where we were until then.
+		else if (env_relative_time.count() < 0) {
+			env.current_amplitude = env.trigger_amplitude;
+		}
+
 		else {
 			env.current_amplitude = env.segments.front().start_amp;
 		}
@@ -142,8 +142,8 @@ namespace vizzy {
 		return env;
 	}
 
-	inline decltype(auto) env_trigger(vizzy::Envelope env, libremidi::message msg) {
-		if (env.pattern(msg)) {
+	inline decltype(auto) env_trigger(vizzy::Envelope env, const vizzy::MidiEvent& ev) {
+		if (env.match.has_value() ? vizzy::midi_matches(env.match.value(), ev) : env.pattern and env.pattern(ev)) {
 			env.trigger_amplitude = env.current_amplitude;
 			env.trigger = vizzy::clock::now();
 		}
@@ -151,14 +151,6 @@ namespace vizzy {
 		return env;
 	}
 
-	inline decltype(auto) env_bind(vizzy::Envelope env, std::vector<GLuint>&& programs) {
-		for (GLuint p: programs) {
-			glUniform1f(glGetUniformLocation(p, env.name.data()), env.current_amplitude);
-		}
-
-		return env;
-	}
-
 }  // namespace vizzy
 
 // Utils
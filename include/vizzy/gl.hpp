@@ -2,12 +2,16 @@
 #define VIZZY_GL_HPP
 
 #include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 
 #include <SDL2/SDL.h>
 #include <glad/gl.h>
 #include <glm/glm.hpp>
 
 #include <vizzy/util.hpp>
+#include <vizzy/handle.hpp>
 
 namespace vizzy::gl::detail {
 #define VIZZY_GL_ENUM(x) \
@@ -95,30 +99,80 @@ namespace vizzy::gl::detail {
 
 }  // namespace vizzy::gl::detail
 
+// Error checking
+// INFO: https://www.khronos.org/opengl/wiki/OpenGL_Error
+// glGetError is a round trip to the driver on a lot of implementations so how often it runs is picked
+// at build time through VIZZY_GL_CHECK, see CMakePresets.json:
+//   Call      after every `call`/`get`, with synchronous debug output so errors point at the call.
+//   Frame     once per frame in `check_frame`.
+//   Callback  never, errors only arrive through asynchronous debug output.
+//   None      never, and no debug context.
+#ifndef VIZZY_GL_CHECK
+#define VIZZY_GL_CHECK Call
+#endif
+
+namespace vizzy::gl {
+	enum class Check {
+		Call,
+		Frame,
+		Callback,
+		None,
+	};
+
+	inline constexpr Check check = Check::VIZZY_GL_CHECK;
+
+	// Debug output only works with a debug context, which can be slower on its own.
+	inline constexpr bool check_debug_context = check == Check::Call or check == Check::Callback;
+
+	namespace detail {
+		// Last GL function called on this thread, only tracked with `Check::Call`. Per thread because the
+		// compile worker calls GL through its shared context at the same time as the render thread.
+		inline thread_local const char* check_last = nullptr;
+	}
+
+	// Call once per frame after submitting it.
+	inline void check_frame() {
+		if constexpr (check == Check::Frame) {
+			if (GLenum status = glGetError(); status != GL_NO_ERROR) {
+				vizzy::die("glGetError(): {} during the frame, build with VIZZY_GL_CHECK=Call to find where",
+					detail::error_to_str(status));
+			}
+		}
+	}
+}  // namespace vizzy::gl
+
 // Getters
 namespace vizzy::gl {
-	template <typename F, typename... Ts>
+	namespace detail {
+		template <Check C>
+		inline void check_call() {
+			if constexpr (C == Check::Call) {
+				if (GLenum status = glGetError(); status != GL_NO_ERROR) {
+					vizzy::die("glGetError(): {} from {}", error_to_str(status), check_last ? check_last : "<unknown>");
+				}
+			}
+		}
+	}  // namespace detail
+
+	// `C` defaults to the build's policy, pass `Check::Call` explicitly where an error must be caught
+	// right away regardless.
+	template <Check C = check, typename F, typename... Ts>
 	[[nodiscard]] inline decltype(auto) call(F&& fn, Ts&&... args) {
 		decltype(auto) v = fn(std::forward<Ts>(args)...);
 
-		if (GLenum status = glGetError(); status != GL_NO_ERROR) {
-			vizzy::die("glGetError(): {}", detail::error_to_str(status));
-		}
-
+		detail::check_call<C>();
 		return v;
 	}
 
-	template <typename F, typename... Ts>
+	template <Check C = check, typename F, typename... Ts>
 		requires std::same_as<std::invoke_result_t<F, Ts...>, void>
 	inline void call(F&& fn, Ts&&... args) {
 		fn(std::forward<Ts>(args)...);
 
-		if (GLenum status = glGetError(); status != GL_NO_ERROR) {
-			vizzy::die("glGetError(): {}", detail::error_to_str(status));
-		}
+		detail::check_call<C>();
 	}
 
-	template <typename F, typename... Ts>
+	template <Check C = check, typename F, typename... Ts>
 		requires std::invocable<F, Ts..., GLint*>
 	[[nodiscard]] inline decltype(auto) get(F fn, Ts&&... args) {
 		// INFO: https://registry.khronos.org/OpenGL-Refpages/gl4/html/glGetProgramPipeline.xhtml
@@ -128,7 +182,7 @@ namespace vizzy::gl {
 
 		GLint v = 0;
 
-		call(fn, std::forward<Ts>(args)..., &v);
+		call<C>(fn, std::forward<Ts>(args)..., &v);
 		return v;
 	}
 
@@ -149,6 +203,85 @@ namespace vizzy::gl {
 	}
 }  // namespace vizzy::gl
 
+// Program introspection
+namespace vizzy::gl {
+	struct Uniform {
+		GLint location = -1;
+		GLenum type = GL_NONE;
+		GLint size = 0;
+	};
+
+	// Name to location table for a linked program, built once after linking so nothing has to go
+	// through glGetUniformLocation at draw time.
+	using Uniforms = std::unordered_map<std::string, Uniform>;
+
+	struct Program {
+		ProgramHandle id {};
+		Uniforms uniforms;
+	};
+
+	[[nodiscard]] inline Uniforms reflect_uniforms(GLuint program) {
+		// INFO: https://www.khronos.org/opengl/wiki/Program_Introspection#Interface_query
+
+		VIZZY_FUNCTION();
+
+		Uniforms uniforms;
+
+		GLint count = 0;
+		GLint max_name_length = 0;
+
+		call(glGetProgramInterfaceiv, program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+		call(glGetProgramInterfaceiv, program, GL_UNIFORM, GL_MAX_NAME_LENGTH, &max_name_length);
+
+		std::string name;
+		name.resize(max_name_length, '\0');
+
+		for (GLint i = 0; i != count; ++i) {
+			const std::array<GLenum, 4> props = { GL_BLOCK_INDEX, GL_LOCATION, GL_TYPE, GL_ARRAY_SIZE };
+			std::array<GLint, 4> values = {};
+
+			call(glGetProgramResourceiv, program, GL_UNIFORM, i, props.size(), props.data(), values.size(), nullptr, values.data());
+
+			auto [block, location, type, size] = values;
+
+			// Members of uniform blocks don't have locations.
+			if (block != -1) {
+				continue;
+			}
+
+			GLsizei length = 0;
+			call(glGetProgramResourceName, program, GL_UNIFORM, i, max_name_length, &length, name.data());
+
+			std::string_view sv { name.data(), static_cast<size_t>(length) };
+
+			// Arrays are reported as `name[0]`.
+			if (sv.ends_with("[0]")) {
+				sv.remove_suffix(3);
+			}
+
+			VIZZY_DEBUG("uniform '{}': location = {}, type = {:#x}, size = {}", sv, location, type, size);
+
+			uniforms.emplace(std::string { sv }, Uniform { location, static_cast<GLenum>(type), size });
+		}
+
+		return uniforms;
+	}
+}  // namespace vizzy::gl
+
+// Shared shader sources
+// Prepended to every shader, generated declarations are inserted between this and the shader body.
+#define VIZZY_GLSL_VERSION "#version 460 core\n"
+
+namespace vizzy::gl {
+	// One triangle covering the viewport, drawn as 3 vertices without attributes.
+	inline constexpr std::string_view fullscreen_vert = R"(
+		void main() {
+			vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+			gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+		}
+	)";
+}  // namespace vizzy::gl
+
 // Wrappers
 namespace vizzy::gl {
 	[[nodiscard]] inline GLuint create_shader(GLenum kind, std::vector<std::string_view> sv) {
@@ -162,10 +295,14 @@ namespace vizzy::gl {
 			vizzy::die("glCreateShader failed!");
 		}
 
+		// Pass lengths explicitly so sources don't need to be null terminated.
 		std::vector<const GLchar*> sources;
+		std::vector<GLint> lengths;
+
 		std::transform(sv.begin(), sv.end(), std::back_inserter(sources), std::mem_fn(&decltype(sv)::value_type::data));
+		std::transform(sv.begin(), sv.end(), std::back_inserter(lengths), std::mem_fn(&decltype(sv)::value_type::size));
 
-		call(glShaderSource, shader, sources.size(), sources.data(), nullptr);
+		call(glShaderSource, shader, sources.size(), sources.data(), lengths.data());
 		call(glCompileShader, shader);
 
 		int ok = gl_get_shader(shader, GL_COMPILE_STATUS);
@@ -189,7 +326,7 @@ namespace vizzy::gl {
 		return shader;
 	}
 
-	[[nodiscard]] inline GLuint create_program(std::vector<GLuint> shaders) {
+	[[nodiscard]] inline Program create_program(std::vector<GLuint> shaders) {
 		VIZZY_FUNCTION();
 
 		GLuint program = call(glCreateProgram);
@@ -199,6 +336,9 @@ namespace vizzy::gl {
 			vizzy::die("glCreateProgram failed!");
 		}
 
+		// Keep the binary around for the program cache.
+		call(glProgramParameteri, program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
 		// Linking
 		for (auto shader: shaders) {
 			VIZZY_DEBUG("shader: {}", shader);
@@ -249,15 +389,15 @@ namespace vizzy::gl {
 
 		VIZZY_OKAY("successfully linked program ({})", program);
 
-		return program;
+		return Program { ProgramHandle { program }, reflect_uniforms(program) };
 	}
 
-	[[nodiscard]] inline GLuint create_shader_program(GLenum kind, std::vector<std::string_view> sv) {
+	[[nodiscard]] inline Program create_shader_program(GLenum kind, std::vector<std::string_view> sv) {
 		VIZZY_FUNCTION();
 		return create_program({ create_shader(kind, sv) });
 	}
 
-	[[nodiscard]] inline GLuint create_pipeline(std::vector<std::pair<GLbitfield, GLuint>> programs) {
+	[[nodiscard]] inline PipelineHandle create_pipeline(std::vector<std::pair<GLbitfield, GLuint>> programs) {
 		// INFO: https://www.khronos.org/opengl/wiki/Shader_Compilation#Separate_programs
 
 		VIZZY_FUNCTION();
@@ -292,10 +432,10 @@ namespace vizzy::gl {
 		}
 
 		VIZZY_OKAY("successfully generated pipeline ({})", pipeline);
-		return pipeline;
+		return PipelineHandle { pipeline };
 	}
 
-	[[nodiscard]] inline GLuint create_pipeline(std::vector<GLuint> programs) {
+	[[nodiscard]] inline PipelineHandle create_pipeline(std::vector<GLuint> programs) {
 		// INFO: https://www.khronos.org/opengl/wiki/Shader_Compilation#Separate_programs
 
 		VIZZY_FUNCTION();
@@ -341,6 +481,7 @@ namespace vizzy::gl {
 // Debugging
 namespace vizzy::gl {
 	namespace detail {
+#ifdef GLAD_OPTION_GL_DEBUG
 		using PreCallback = void (*)(const char* name, GLADapiproc apiproc, int len_args, ...);
 		using PostCallback = void (*)(void* ret, const char* name, GLADapiproc apiproc, int len_args, ...);
 
@@ -358,7 +499,14 @@ namespace vizzy::gl {
 			[[maybe_unused]] int len_args,
 			...) {
 			// VIZZY_WARN("PostCallback '{}'", name);
+
+			if constexpr (check == Check::Call) {
+				if (std::string_view { name } != "glGetError") {
+					check_last = name;
+				}
+			}
 		}
+#endif
 
 		inline void debug_callback(GLenum source,
 			GLenum type,
@@ -380,14 +528,22 @@ namespace vizzy::gl {
 	inline void setup_debug_callbacks() {
 		VIZZY_FUNCTION();
 
-		SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+		VIZZY_DEBUG("check = {}", VIZZY_STR(VIZZY_GL_CHECK));
 
+#ifdef GLAD_OPTION_GL_DEBUG
+		// GLAD's default post callback runs glGetError after every call, these replace it. Only the
+		// debug loader has callbacks at all, other builds call straight through.
 		gladSetGLPreCallback(detail::pre_callback);
 		gladSetGLPostCallback(detail::post_callback);
+#endif
 
-		if (gl_get_integer(GL_CONTEXT_FLAGS) & GL_CONTEXT_FLAG_DEBUG_BIT) {
+		if (check_debug_context and gl_get_integer(GL_CONTEXT_FLAGS) & GL_CONTEXT_FLAG_DEBUG_BIT) {
 			glEnable(GL_DEBUG_OUTPUT);
-			glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+
+			// Stalls the driver, but messages arrive while the offending call is still on the stack.
+			if constexpr (check == Check::Call) {
+				glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+			}
 
 			glDebugMessageCallback(detail::debug_callback, nullptr);
 			glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
@@ -0,0 +1,223 @@
+#ifndef VIZZY_GPUBANK_HPP
+#define VIZZY_GPUBANK_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include <vizzy/util.hpp>
+#include <vizzy/log.hpp>
+#include <vizzy/gl.hpp>
+#include <vizzy/bank.hpp>
+#include <vizzy/storage.hpp>
+
+// GPU envelopes
+// A level is a pure function of the time since the trigger and the segment table, so instead of
+// evaluating every envelope on the CPU each frame the tables are uploaded once and shaders evaluate
+// the envelopes they read through `vizzy_envelope(i)` (or the usual names, which expand to it). The
+// only per-frame CPU work is uploading the triggers of envelopes that fired since the last frame, so
+// the cost follows the number of events rather than the number of envelopes.
+//
+// Retriggering starts from the level the envelope had at that moment, which the CPU evaluates for
+// that one envelope when it fires. Trigger times are kept as full clock ticks and subtracted from
+// the frame's `clock` in the shader with a borrow, floats alone would lose milliseconds within hours.
+namespace vizzy {
+	inline constexpr GLuint curves_binding = 1;
+	inline constexpr GLuint triggers_binding = 2;
+
+	// Matches `VizzyTrigger` in `gpu_bank_glsl`.
+	struct GpuTrigger {
+		std::array<uint32_t, 2> time {};  // vizzy::clock ticks, see `frame_ticks`.
+		float amplitude = 0.f;
+		float rest = 0.f;
+	};
+
+	static_assert(sizeof(GpuTrigger) == 16, "GpuTrigger must match the std430 layout in gpu_bank_glsl");
+
+	struct GpuBank {
+		gl::BufferHandle curves {};  // Immutable segment tables, envelope-major.
+		gl::BufferHandle triggers {};
+
+		std::vector<GpuTrigger> staging;  // Contiguous runs of fired triggers.
+
+		// Counters
+		uint64_t uploads = 0;
+		uint64_t uploaded = 0;  // Triggers, a note fired twice in a frame counts once.
+	};
+
+	namespace detail {
+		[[nodiscard]] inline GpuTrigger gpu_bank_trigger(const EnvelopeBank& bank, size_t i) {
+			return {
+				.time = frame_ticks(vizzy::timepoint { vizzy::clock::duration { bank.triggers[i] } }),
+				.amplitude = bank.trigger_amplitudes[i],
+				.rest = bank.rest_amplitudes[i],
+			};
+		}
+	}  // namespace detail
+
+	// Marks the bank as deferred, so this has to happen before the frame block is generated and
+	// before anything is triggered. Envelopes can't be added afterwards.
+	[[nodiscard]] inline GpuBank create_gpu_bank(EnvelopeBank& bank) {
+		VIZZY_FUNCTION();
+
+		bank.deferred = true;
+
+		GpuBank gpu;
+
+		// Each envelope's segments sit next to each other, a shader only ever walks one envelope.
+		std::vector<std::array<float, 4>> curves(std::max<size_t>(bank.count * bank.max_segments, 1));
+
+		for (size_t i = 0; i != bank.count; ++i) {
+			for (size_t s = 0; s != bank.max_segments; ++s) {
+				size_t index = s * bank.stride + i;
+
+				curves[i * bank.max_segments + s] = {
+					bank.seg_start[index],
+					bank.seg_end[index],
+					bank.seg_start_amp[index],
+					bank.seg_end_amp[index],
+				};
+			}
+		}
+
+		std::vector<GpuTrigger> triggers(std::max<size_t>(bank.count, 1));
+
+		for (size_t i = 0; i != bank.count; ++i) {
+			triggers[i] = detail::gpu_bank_trigger(bank, i);
+		}
+
+		gl::call(glCreateBuffers, 1, &gpu.curves.id);
+		gl::call(glNamedBufferStorage, gpu.curves, curves.size() * sizeof(curves[0]), curves.data(), 0);
+
+		gl::call(glCreateBuffers, 1, &gpu.triggers.id);
+		gl::call(glNamedBufferStorage,
+			gpu.triggers,
+			triggers.size() * sizeof(GpuTrigger),
+			triggers.data(),
+			GL_DYNAMIC_STORAGE_BIT);
+
+		// Nothing else uses these bindings, they stay put for the whole run.
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, curves_binding, gpu.curves);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, triggers_binding, gpu.triggers);
+
+		VIZZY_DEBUG("envelopes = {}, segments = {}", bank.count, bank.max_segments);
+		VIZZY_OKAY("successfully created gpu envelopes ({}, {})", gpu.curves, gpu.triggers);
+
+		return gpu;
+	}
+
+	inline void destroy_gpu_bank(GpuBank& gpu) {
+		gpu = {};
+	}
+
+	// GLSL library and defines, goes after the frame block.
+	[[nodiscard]] inline std::string gpu_bank_glsl(const EnvelopeBank& bank) {
+		using ticks = vizzy::clock::duration;
+		constexpr double to_ms = std::chrono::duration<double, std::milli>(ticks(1)).count();
+
+		std::string glsl = fmt::format(R"(
+			struct VizzyTrigger {{
+				uvec2 time;
+				float amplitude;
+				float rest;
+			}};
+
+			layout (std430, binding = {}) readonly buffer VizzyCurves {{
+				vec4 curves[{}];  // start ms, end ms, start amplitude, end amplitude
+			}};
+
+			layout (std430, binding = {}) readonly buffer VizzyTriggers {{
+				VizzyTrigger triggers[{}];
+			}};
+
+			// Milliseconds since envelope `i` was triggered, negative if it's scheduled ahead.
+			float vizzy_since(uint i) {{
+				uint borrow;
+				uint lo = usubBorrow(clock.x, triggers[i].time.x, borrow);
+				int hi = int(clock.y - triggers[i].time.y - borrow);
+
+				return (float(hi) * 4294967296.0 + float(lo)) * {:e};
+			}}
+
+			float vizzy_envelope(uint i) {{
+				VizzyTrigger trigger = triggers[i];
+				float t = vizzy_since(i);
+
+				float amp = t < 0.0 ? trigger.amplitude : trigger.rest;
+
+				for (uint s = 0u; s != {}u; ++s) {{
+					vec4 segment = curves[i * {}u + s];
+
+					if (t >= segment.x && t < segment.y) {{
+						float from = s == 0u ? trigger.amplitude : segment.z;
+						amp = mix(from, segment.w, (t - segment.x) / (segment.y - segment.x));
+					}}
+				}}
+
+				return amp;
+			}}
+		)",
+			curves_binding,
+			std::max<size_t>(bank.count * bank.max_segments, 1),
+			triggers_binding,
+			std::max<size_t>(bank.count, 1),
+			to_ms,
+			bank.max_segments,
+			bank.max_segments);
+
+		for (size_t i = 0; i != bank.count; ++i) {
+			glsl += fmt::format("#define {} vizzy_envelope({}u)\n", bank.names[i], i);
+		}
+
+		return glsl;
+	}
+
+	// Uploads the triggers of every envelope that fired since the last call, once per frame before
+	// drawing. Buffer updates are ordered after the draws already issued, so frames in flight keep
+	// reading the triggers they were drawn with.
+	inline void gpu_bank_upload(GpuBank& gpu, EnvelopeBank& bank) {
+		if (bank.fired.empty()) {
+			return;
+		}
+
+		std::ranges::sort(bank.fired);
+		auto [last, end] = std::ranges::unique(bank.fired);
+		bank.fired.erase(last, end);
+
+		for (size_t first = 0; first != bank.fired.size();) {
+			size_t next = first + 1;
+
+			while (next != bank.fired.size() and bank.fired[next] == bank.fired[next - 1] + 1) {
+				++next;
+			}
+
+			gpu.staging.clear();
+
+			for (size_t k = first; k != next; ++k) {
+				gpu.staging.push_back(detail::gpu_bank_trigger(bank, bank.fired[k]));
+			}
+
+			glNamedBufferSubData(gpu.triggers,
+				static_cast<GLintptr>(bank.fired[first] * sizeof(GpuTrigger)),
+				static_cast<GLsizeiptr>(gpu.staging.size() * sizeof(GpuTrigger)),
+				gpu.staging.data());
+
+			gpu.uploads++;
+			first = next;
+		}
+
+		gpu.uploaded += bank.fired.size();
+		bank.fired.clear();
+	}
+
+	inline void gpu_bank_report(const GpuBank& gpu) {
+		VIZZY_OKAY("gpu envelopes: {} triggers in {} uploads", gpu.uploaded, gpu.uploads);
+	}
+}  // namespace vizzy
+
+#endif
@@ -0,0 +1,529 @@
+#ifndef VIZZY_GRAPH_HPP
+#define VIZZY_GRAPH_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include <vizzy/util.hpp>
+#include <vizzy/log.hpp>
+#include <vizzy/gl.hpp>
+#include <vizzy/profile.hpp>
+
+// Render graph
+// INFO: https://www.gdcvault.com/play/1024612/FrameGraph-Extensible-Rendering-Architecture-in
+// Passes declare the textures they read and write and are run in declaration order, minus any pass
+// whose output never reaches the screen or a history texture. Transient textures only exist between
+// their first write and last read, so once a resource is dead its texture is handed to the next one
+// with the same format and size. GL has no way to alias raw memory, reusing the texture object is
+// the equivalent. Everything is allocated when the graph is compiled and only reallocated on resize.
+namespace vizzy::gl {
+	using GraphId = uint32_t;
+
+	struct GraphTextureDesc {
+		GLenum format = GL_RGBA16F;
+		float scale = 1.f;  // Relative to the graph's size.
+	};
+
+	enum class GraphResourceKind {
+		Transient,
+		History,  // Persists between frames, reads before the first write of a frame see the previous frame.
+		Output,  // Whatever framebuffer is passed to `graph_execute`.
+	};
+
+	struct GraphResource {
+		const char* name;
+		GraphResourceKind kind;
+		GraphTextureDesc desc;
+
+		std::array<GLuint, 2> textures {};  // History ping-pongs between both, transients only use the first.
+		std::array<TextureHandle, 2> history {};  // Owned by history, transients borrow from the pool.
+
+		int width = 0;
+		int height = 0;
+
+		// Lifetime as indices into the schedule.
+		size_t first = 0;
+		size_t last = 0;
+	};
+
+	struct GraphPass;
+	struct RenderGraph;
+
+	using GraphExecute = std::function<void(const RenderGraph&, const GraphPass&)>;
+
+	struct GraphPass {
+		const char* name = nullptr;
+
+		std::vector<GraphId> reads;  // Bound to texture units in order.
+		std::vector<GraphId> writes;  // Colour attachments in order.
+
+		GraphExecute execute;
+
+		// Indexed by frame parity so history alternates.
+		std::array<FramebufferHandle, 2> framebuffers {};
+		std::array<std::vector<GLuint>, 2> inputs;  // Texture per read.
+
+		int width = 0;
+		int height = 0;
+	};
+
+	struct GraphTexture {
+		TextureHandle texture;
+		GLenum format;
+
+		int width;
+		int height;
+	};
+
+	struct RenderGraph {
+		std::vector<GraphResource> resources;
+		std::vector<GraphPass> passes;
+
+		std::vector<size_t> schedule;  // Passes that survived culling.
+		std::vector<GraphTexture> pool;  // Backs every transient.
+
+		GLuint output = 0;  // Framebuffer for `GraphResourceKind::Output`, only valid during `graph_execute`.
+
+		int width = 0;
+		int height = 0;
+
+		size_t frame = 0;
+		bool compiled = false;
+	};
+
+	[[nodiscard]] inline GraphId graph_texture(RenderGraph& graph, const char* name, GraphTextureDesc desc = {}) {
+		graph.resources.push_back({ name, GraphResourceKind::Transient, desc });
+		graph.compiled = false;
+
+		return static_cast<GraphId>(graph.resources.size() - 1);
+	}
+
+	[[nodiscard]] inline GraphId graph_history(RenderGraph& graph, const char* name, GraphTextureDesc desc = {}) {
+		graph.resources.push_back({ name, GraphResourceKind::History, desc });
+		graph.compiled = false;
+
+		return static_cast<GraphId>(graph.resources.size() - 1);
+	}
+
+	[[nodiscard]] inline GraphId graph_output(RenderGraph& graph) {
+		graph.resources.push_back({ "output", GraphResourceKind::Output, {} });
+		graph.compiled = false;
+
+		return static_cast<GraphId>(graph.resources.size() - 1);
+	}
+
+	inline void graph_pass(RenderGraph& graph,
+		const char* name,
+		std::vector<GraphId> reads,
+		std::vector<GraphId> writes,
+		GraphExecute execute) {
+		// Culling would drop it without a word.
+		if (writes.empty()) {
+			vizzy::die("pass '{}' writes nothing", name);
+		}
+
+		GraphPass pass;
+
+		pass.name = name;
+		pass.reads = std::move(reads);
+		pass.writes = std::move(writes);
+		pass.execute = std::move(execute);
+
+		graph.passes.push_back(std::move(pass));
+		graph.compiled = false;
+	}
+
+	// Texture bound for the pass's `index`th read this frame.
+	[[nodiscard]] inline GLuint graph_input(const RenderGraph& graph, const GraphPass& pass, size_t index) {
+		return pass.inputs[graph.frame & 1][index];
+	}
+
+	// Texture behind the pass's `index`th write this frame, for passes that store to images rather than
+	// render into the framebuffer.
+	[[nodiscard]] inline GLuint graph_target(const RenderGraph& graph, const GraphPass& pass, size_t index) {
+		const GraphResource& resource = graph.resources[pass.writes[index]];
+
+		if (resource.kind == GraphResourceKind::History) {
+			return resource.textures[graph.frame & 1];
+		}
+
+		return resource.textures[0];
+	}
+
+	namespace detail {
+		[[nodiscard]] inline size_t graph_format_size(GLenum format) {
+			switch (format) {
+				case GL_R8: return 1;
+				case GL_RG8:
+				case GL_R16F: return 2;
+				case GL_RGBA8:
+				case GL_RGB10_A2:
+				case GL_R11F_G11F_B10F:
+				case GL_RG16F:
+				case GL_R32F: return 4;
+				case GL_RGBA16F:
+				case GL_RG32F: return 8;
+				case GL_RGBA32F: return 16;
+				default: return 4;
+			}
+		}
+
+		[[nodiscard]] inline TextureHandle graph_create_texture(GLenum format, int width, int height) {
+			GLuint texture;
+			call(glCreateTextures, GL_TEXTURE_2D, 1, &texture);
+			call(glTextureStorage2D, texture, 1, format, width, height);
+
+			call(glTextureParameteri, texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			call(glTextureParameteri, texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			call(glTextureParameteri, texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			call(glTextureParameteri, texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+			return TextureHandle { texture };
+		}
+
+		// Drops every texture and framebuffer. The last frame may still be using them so the deletes are
+		// deferred, which keeps a resize from waiting on the GPU.
+		inline void graph_release(RenderGraph& graph) {
+			for (auto& pass: graph.passes) {
+				pass.framebuffers = {};
+				pass.inputs = {};
+			}
+
+			for (auto& resource: graph.resources) {
+				resource.textures = {};
+				resource.history = {};
+			}
+
+			graph.pool.clear();
+			graph.schedule.clear();
+
+			graph.compiled = false;
+		}
+
+		// Drops passes that nothing visible depends on, walking backwards from the output and history.
+		inline void graph_cull(RenderGraph& graph) {
+			std::vector<bool> needed(graph.resources.size());
+
+			for (size_t i = 0; i != graph.resources.size(); ++i) {
+				needed[i] = graph.resources[i].kind != GraphResourceKind::Transient;
+			}
+
+			for (size_t i = graph.passes.size(); i != 0; --i) {
+				const GraphPass& pass = graph.passes[i - 1];
+
+				bool live = std::any_of(pass.writes.begin(), pass.writes.end(), [&](GraphId id) {
+					return needed[id];
+				});
+
+				if (not live) {
+					VIZZY_DEBUG("culled pass '{}'", pass.name);
+					continue;
+				}
+
+				for (GraphId id: pass.reads) {
+					needed[id] = true;
+				}
+
+				graph.schedule.push_back(i - 1);
+			}
+
+			std::reverse(graph.schedule.begin(), graph.schedule.end());
+		}
+
+		inline void graph_lifetimes(RenderGraph& graph) {
+			std::vector<bool> written(graph.resources.size());
+
+			// Left over from the previous compile otherwise, which `std::max` below would keep.
+			for (GraphResource& resource: graph.resources) {
+				resource.first = 0;
+				resource.last = 0;
+			}
+
+			for (size_t i = 0; i != graph.schedule.size(); ++i) {
+				const GraphPass& pass = graph.passes[graph.schedule[i]];
+
+				for (GraphId id: pass.reads) {
+					GraphResource& resource = graph.resources[id];
+
+					if (resource.kind == GraphResourceKind::Output) {
+						vizzy::die("pass '{}' reads the output", pass.name);
+					}
+
+					if (resource.kind == GraphResourceKind::Transient and not written[id]) {
+						vizzy::die("pass '{}' reads '{}' before it is written", pass.name, resource.name);
+					}
+
+					// History is fine, reads and writes go to different textures.
+					if (resource.kind == GraphResourceKind::Transient and
+						std::find(pass.writes.begin(), pass.writes.end(), id) != pass.writes.end()) {
+						vizzy::die("pass '{}' reads and writes '{}'", pass.name, resource.name);
+					}
+
+					resource.last = i;
+				}
+
+				for (GraphId id: pass.writes) {
+					GraphResource& resource = graph.resources[id];
+
+					if (not written[id]) {
+						resource.first = i;
+						written[id] = true;
+					}
+
+					resource.last = std::max(resource.last, i);
+				}
+			}
+		}
+
+		// Greedy interval allocation over the schedule. A pass's writes are allocated before its dead
+		// reads are released so a pass never renders into a texture it's sampling.
+		inline void graph_allocate(RenderGraph& graph) {
+			std::vector<size_t> free;  // Indices into `graph.pool`.
+			std::vector<size_t> slots(graph.resources.size());
+
+			for (auto& resource: graph.resources) {
+				resource.width = std::max(1, static_cast<int>(std::lround(graph.width * resource.desc.scale)));
+				resource.height = std::max(1, static_cast<int>(std::lround(graph.height * resource.desc.scale)));
+
+				if (resource.kind == GraphResourceKind::History) {
+					for (size_t parity = 0; parity != 2; ++parity) {
+						resource.history[parity] =
+							graph_create_texture(resource.desc.format, resource.width, resource.height);
+						resource.textures[parity] = resource.history[parity];
+
+						call(glClearTexImage, resource.textures[parity], 0, GL_RGBA, GL_FLOAT, nullptr);
+					}
+				}
+
+				if (resource.kind == GraphResourceKind::Output) {
+					resource.width = graph.width;
+					resource.height = graph.height;
+				}
+			}
+
+			for (size_t i = 0; i != graph.schedule.size(); ++i) {
+				const GraphPass& pass = graph.passes[graph.schedule[i]];
+
+				for (GraphId id: pass.writes) {
+					GraphResource& resource = graph.resources[id];
+
+					if (resource.kind != GraphResourceKind::Transient or resource.first != i) {
+						continue;
+					}
+
+					auto it = std::find_if(free.begin(), free.end(), [&](size_t slot) {
+						const GraphTexture& texture = graph.pool[slot];
+
+						return texture.format == resource.desc.format and texture.width == resource.width and
+							texture.height == resource.height;
+					});
+
+					if (it != free.end()) {
+						slots[id] = *it;
+						free.erase(it);
+					}
+
+					else {
+						slots[id] = graph.pool.size();
+						graph.pool.push_back({
+							graph_create_texture(resource.desc.format, resource.width, resource.height),
+							resource.desc.format,
+							resource.width,
+							resource.height,
+						});
+					}
+
+					resource.textures[0] = graph.pool[slots[id]].texture;
+				}
+
+				auto release = [&](GraphId id) {
+					const GraphResource& resource = graph.resources[id];
+
+					if (resource.kind == GraphResourceKind::Transient and resource.last == i and
+						std::find(free.begin(), free.end(), slots[id]) == free.end()) {
+						free.push_back(slots[id]);
+					}
+				};
+
+				std::for_each(pass.reads.begin(), pass.reads.end(), release);
+				std::for_each(pass.writes.begin(), pass.writes.end(), release);
+			}
+		}
+
+		inline void graph_bindings(RenderGraph& graph) {
+			std::vector<bool> written(graph.resources.size());
+
+			for (size_t index: graph.schedule) {
+				GraphPass& pass = graph.passes[index];
+
+				for (size_t parity = 0; parity != 2; ++parity) {
+					for (GraphId id: pass.reads) {
+						const GraphResource& resource = graph.resources[id];
+						GLuint texture = resource.textures[0];
+
+						// Until this frame's first write the current texture still holds two frames ago.
+						if (resource.kind == GraphResourceKind::History) {
+							texture = resource.textures[written[id] ? parity : parity ^ 1];
+						}
+
+						pass.inputs[parity].push_back(texture);
+					}
+				}
+
+				for (GraphId id: pass.writes) {
+					written[id] = true;
+				}
+
+				const GraphResource& first = graph.resources[pass.writes.front()];
+
+				pass.width = first.width;
+				pass.height = first.height;
+
+				if (first.kind == GraphResourceKind::Output) {
+					if (pass.writes.size() != 1) {
+						vizzy::die("pass '{}' writes the output along with other textures", pass.name);
+					}
+
+					continue;
+				}
+
+				for (size_t parity = 0; parity != 2; ++parity) {
+					GLuint framebuffer;
+					call(glCreateFramebuffers, 1, &framebuffer);
+
+					std::vector<GLenum> attachments;
+
+					for (GraphId id: pass.writes) {
+						const GraphResource& resource = graph.resources[id];
+
+						if (resource.kind == GraphResourceKind::Output) {
+							vizzy::die("pass '{}' writes the output along with other textures", pass.name);
+						}
+
+						if (resource.width != pass.width or resource.height != pass.height) {
+							vizzy::die("pass '{}' writes textures of different sizes", pass.name);
+						}
+
+						GLenum attachment = GL_COLOR_ATTACHMENT0 + static_cast<GLenum>(attachments.size());
+						GLuint texture = resource.kind == GraphResourceKind::History ? resource.textures[parity] :
+																					   resource.textures[0];
+
+						call(glNamedFramebufferTexture, framebuffer, attachment, texture, 0);
+						attachments.push_back(attachment);
+					}
+
+					call(glNamedFramebufferDrawBuffers,
+						framebuffer,
+						static_cast<GLsizei>(attachments.size()),
+						attachments.data());
+
+					if (GLenum status = glCheckNamedFramebufferStatus(framebuffer, GL_FRAMEBUFFER);
+						status != GL_FRAMEBUFFER_COMPLETE) {
+						vizzy::die("pass '{}' framebuffer incomplete! status = {:#x}", pass.name, status);
+					}
+
+					pass.framebuffers[parity] = FramebufferHandle { framebuffer };
+				}
+			}
+		}
+	}  // namespace detail
+
+	// Schedules the passes and allocates every texture and framebuffer for a `width` by `height` output.
+	inline void graph_compile(RenderGraph& graph, int width, int height) {
+		VIZZY_FUNCTION();
+
+		detail::graph_release(graph);
+
+		graph.width = width;
+		graph.height = height;
+
+		detail::graph_cull(graph);
+		detail::graph_lifetimes(graph);
+		detail::graph_allocate(graph);
+		detail::graph_bindings(graph);
+
+		size_t transients = 0;
+		size_t naive = 0;
+		size_t pooled = 0;
+
+		for (const auto& resource: graph.resources) {
+			size_t bytes =
+				detail::graph_format_size(resource.desc.format) * static_cast<size_t>(resource.width * resource.height);
+
+			// Culled transients never got a texture.
+			if (resource.kind == GraphResourceKind::Transient and resource.textures[0] != 0) {
+				transients++;
+				naive += bytes;
+			}
+
+			if (resource.kind == GraphResourceKind::History) {
+				pooled += 2 * bytes;
+				naive += 2 * bytes;
+			}
+		}
+
+		for (const auto& [texture, format, w, h]: graph.pool) {
+			pooled += detail::graph_format_size(format) * static_cast<size_t>(w * h);
+		}
+
+		VIZZY_OKAY("compiled {}x{} graph: {}/{} passes, {} transients in {} textures, {:.1f}MiB ({:.1f}MiB unaliased)",
+			width,
+			height,
+			graph.schedule.size(),
+			graph.passes.size(),
+			transients,
+			graph.pool.size(),
+			static_cast<double>(pooled) / (1 << 20),
+			static_cast<double>(naive) / (1 << 20));
+
+		graph.compiled = true;
+	}
+
+	// Call every frame, recompiles only when the size changed. Returns true if it did.
+	inline bool graph_resize(RenderGraph& graph, int width, int height) {
+		if (graph.compiled and graph.width == width and graph.height == height) {
+			return false;
+		}
+
+		graph_compile(graph, width, height);
+		return true;
+	}
+
+	inline void graph_execute(RenderGraph& graph, GpuProfiler& profiler, GLuint output) {
+		graph.output = output;
+
+		for (size_t index: graph.schedule) {
+			const GraphPass& pass = graph.passes[index];
+
+			VIZZY_ZONE(pass.name);
+			VIZZY_GPU_ZONE(profiler, pass.name);
+
+			GLuint framebuffer = pass.framebuffers[graph.frame & 1];
+
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer == 0 ? output : framebuffer);
+			glViewport(0, 0, pass.width, pass.height);
+
+			for (size_t unit = 0; unit != pass.reads.size(); ++unit) {
+				glBindTextureUnit(static_cast<GLuint>(unit), graph_input(graph, pass, unit));
+			}
+
+			pass.execute(graph, pass);
+		}
+
+		graph.output = 0;
+		graph.frame++;
+	}
+
+	inline void destroy_render_graph(RenderGraph& graph) {
+		detail::graph_release(graph);
+		graph = {};
+	}
+}  // namespace vizzy::gl
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef VIZZY_HANDLE_HPP
+#define VIZZY_HANDLE_HPP
+
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include <fmt/format.h>
+
+// Object handles
+// INFO: https://www.khronos.org/opengl/wiki/Common_Mistakes#The_Object_Oriented_Language_Problem
+// Move-only owners of GL object names. Dropping a handle doesn't delete the object, it's queued and
+// deleted once a fence inserted after the last frame that could have used it has signalled, so
+// swapping programs on reload or reallocating textures on resize never waits on the GPU. Handles
+// belong to the render thread and the queue must be flushed before the context is destroyed.
+namespace vizzy::gl {
+	enum class ObjectKind {
+		Program,
+		Shader,
+		Pipeline,
+		Buffer,
+		Texture,
+		Framebuffer,
+		Renderbuffer,
+		VertexArray,
+	};
+
+	namespace detail {
+		struct Deletion {
+			ObjectKind kind;
+			GLuint id;
+		};
+
+		struct DeletionBatch {
+			GLsync fence;
+			std::vector<Deletion> objects;
+		};
+
+		inline std::vector<Deletion> deletion_recent;  // Released since the last `deletion_frame`.
+		inline std::deque<DeletionBatch> deletion_batches;  // Oldest first, fences signal in order.
+
+		inline void deletion_delete(Deletion object) {
+			switch (object.kind) {
+				case ObjectKind::Program: glDeleteProgram(object.id); break;
+				case ObjectKind::Shader: glDeleteShader(object.id); break;
+				case ObjectKind::Pipeline: glDeleteProgramPipelines(1, &object.id); break;
+				case ObjectKind::Buffer: glDeleteBuffers(1, &object.id); break;
+				case ObjectKind::Texture: glDeleteTextures(1, &object.id); break;
+				case ObjectKind::Framebuffer: glDeleteFramebuffers(1, &object.id); break;
+				case ObjectKind::Renderbuffer: glDeleteRenderbuffers(1, &object.id); break;
+				case ObjectKind::VertexArray: glDeleteVertexArrays(1, &object.id); break;
+			}
+		}
+	}  // namespace detail
+
+	inline void deletion_defer(ObjectKind kind, GLuint id) {
+		detail::deletion_recent.push_back({ kind, id });
+	}
+
+	// Call once per frame after submitting it. Fences whatever was released during the frame and
+	// deletes batches the GPU is done with, never blocks.
+	inline void deletion_frame() {
+		if (not detail::deletion_recent.empty()) {
+			detail::deletion_batches.push_back({
+				glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0),
+				std::move(detail::deletion_recent),
+			});
+
+			detail::deletion_recent = {};
+		}
+
+		while (not detail::deletion_batches.empty()) {
+			auto& [fence, objects] = detail::deletion_batches.front();
+
+			if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+				break;
+			}
+
+			glDeleteSync(fence);
+
+			for (auto object: objects) {
+				detail::deletion_delete(object);
+			}
+
+			detail::deletion_batches.pop_front();
+		}
+	}
+
+	// Deletes everything still queued, waiting on the GPU if it has to. Call before destroying the
+	// context.
+	inline void deletion_flush() {
+		for (auto& [fence, objects]: detail::deletion_batches) {
+			glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
+			glDeleteSync(fence);
+
+			for (auto object: objects) {
+				detail::deletion_delete(object);
+			}
+		}
+
+		for (auto object: detail::deletion_recent) {
+			detail::deletion_delete(object);
+		}
+
+		detail::deletion_batches.clear();
+		detail::deletion_recent.clear();
+	}
+
+	template <ObjectKind K>
+	struct Handle {
+		GLuint id = 0;
+
+		Handle() = default;
+		explicit Handle(GLuint id_): id(id_) {}
+
+		Handle(Handle&& other) noexcept: id(std::exchange(other.id, 0)) {}
+
+		Handle& operator=(Handle&& other) noexcept {
+			if (this != &other) {
+				reset(std::exchange(other.id, 0));
+			}
+
+			return *this;
+		}
+
+		Handle(const Handle&) = delete;
+		Handle& operator=(const Handle&) = delete;
+
+		~Handle() {
+			reset();
+		}
+
+		// Queues the current object for deletion and takes ownership of `next`.
+		void reset(GLuint next = 0) {
+			if (id != 0) {
+				deletion_defer(K, id);
+			}
+
+			id = next;
+		}
+
+		[[nodiscard]] GLuint release() {
+			return std::exchange(id, 0);
+		}
+
+		operator GLuint() const {
+			return id;
+		}
+	};
+
+	using ProgramHandle = Handle<ObjectKind::Program>;
+	using ShaderHandle = Handle<ObjectKind::Shader>;
+	using PipelineHandle = Handle<ObjectKind::Pipeline>;
+	using BufferHandle = Handle<ObjectKind::Buffer>;
+	using TextureHandle = Handle<ObjectKind::Texture>;
+	using FramebufferHandle = Handle<ObjectKind::Framebuffer>;
+	using RenderbufferHandle = Handle<ObjectKind::Renderbuffer>;
+	using VertexArrayHandle = Handle<ObjectKind::VertexArray>;
+}  // namespace vizzy::gl
+
+template <vizzy::gl::ObjectKind K>
+struct fmt::formatter<vizzy::gl::Handle<K>>: fmt::formatter<GLuint> {
+	auto format(const vizzy::gl::Handle<K>& handle, fmt::format_context& ctx) const {
+		return fmt::formatter<GLuint>::format(handle.id, ctx);
+	}
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef VIZZY_LATENCY_HPP
+#define VIZZY_LATENCY_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include <libremidi/message.hpp>
+
+#include <vizzy/util.hpp>
+#include <vizzy/log.hpp>
+#include <vizzy/midi.hpp>
+
+// Latency measurement
+// Enabled with `--latency <count>`. Notes are injected through the same callback a MIDI port would
+// call, and each one is followed until the first frame that includes it has been swapped and then
+// finished on the GPU.
+namespace vizzy {
+	struct LatencyStats {
+		std::vector<vizzy::timepoint> pending;  // Probe triggers not rendered yet, paired with `origins`.
+		std::vector<vizzy::timepoint> origins;
+
+		std::vector<vizzy::timepoint> frame;  // Origins of probes in the frame being drawn.
+
+		std::vector<vizzy::clock::duration> swap;  // Origin to swap returning.
+		std::vector<vizzy::clock::duration> fence;  // Origin to the GPU finishing the frame.
+	};
+
+	// `origin` is when the note entered the callback, `trigger` when envelopes will react to it.
+	inline void latency_trigger(LatencyStats& stats, vizzy::timepoint origin, vizzy::timepoint trigger) {
+		stats.pending.push_back(trigger);
+		stats.origins.push_back(origin);
+	}
+
+	// Call with the time envelopes were evaluated at for the frame.
+	inline void latency_frame(LatencyStats& stats, vizzy::timepoint frame_time) {
+		for (size_t i = stats.pending.size(); i != 0; --i) {
+			if (stats.pending[i - 1] > frame_time) {
+				continue;
+			}
+
+			stats.frame.push_back(stats.origins[i - 1]);
+
+			stats.pending.erase(stats.pending.begin() + static_cast<std::ptrdiff_t>(i - 1));
+			stats.origins.erase(stats.origins.begin() + static_cast<std::ptrdiff_t>(i - 1));
+		}
+	}
+
+	// Call right after the swap. Blocks until the GPU has finished the frame, but only for frames that
+	// carry a probe so the rest of the run is pipelined as usual.
+	inline void latency_swapped(LatencyStats& stats) {
+		if (stats.frame.empty()) {
+			return;
+		}
+
+		auto swapped = vizzy::clock::now();
+
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
+		glDeleteSync(fence);
+
+		auto finished = vizzy::clock::now();
+
+		for (auto origin: stats.frame) {
+			stats.swap.push_back(swapped - origin);
+			stats.fence.push_back(finished - origin);
+		}
+
+		stats.frame.clear();
+	}
+
+	[[nodiscard]] inline bool latency_idle(const LatencyStats& stats) {
+		return stats.pending.empty() and stats.frame.empty();
+	}
+
+	inline void latency_report(LatencyStats& stats) {
+		using ms = std::chrono::duration<double, std::milli>;
+
+		if (stats.swap.empty()) {
+			VIZZY_WARN("no probes were rendered");
+			return;
+		}
+
+		auto report = [&](std::string_view name, std::vector<vizzy::clock::duration>& samples) {
+			VIZZY_OKAY("{} latency over {} notes: p50 = {:.3f}ms, p99 = {:.3f}ms, max = {:.3f}ms",
+				name,
+				samples.size(),
+				ms(vizzy::percentile(samples, .5)).count(),
+				ms(vizzy::percentile(samples, .99)).count(),
+				ms(*std::max_element(samples.begin(), samples.end())).count());
+		};
+
+		report("midi-to-swap", stats.swap);
+		report("midi-to-fence", stats.fence);
+	}
+
+	// Plays notes on its own thread like a MIDI driver would, timestamped on the steady clock to
+	// match `timestamp_mode::SystemMonotonic`.
+	struct LatencyInjector {
+		std::thread thread;
+
+		std::atomic<bool> done = false;
+		std::atomic<bool> stop = false;  // Asks the thread to finish early.
+
+		// Joins the thread if `latency_join` wasn't reached, e.g. when `vizzy::die` unwinds past it.
+		~LatencyInjector();
+	};
+
+	template <typename F>
+	inline void latency_inject(LatencyInjector& injector, size_t count, F fn) {
+		injector.thread = std::thread([&injector, count, fn = std::move(fn)]() mutable {
+			// Irregular spacing so notes don't phase lock to vsync and always land at the same point in a frame.
+			std::minstd_rand rng { 1 };
+			std::uniform_int_distribution<int> spacing { 100, 200 };
+
+			auto stamp = [](libremidi::message msg) {
+				msg.timestamp = vizzy::profile_now();
+				return msg;
+			};
+
+			for (size_t i = 0; i != count and not injector.stop; ++i) {
+				auto interval = std::chrono::milliseconds { spacing(rng) };
+
+				fn(stamp(libremidi::message::note_on(1, 60, 100)));
+				std::this_thread::sleep_for(interval / 2);
+
+				fn(stamp(libremidi::message::note_off(1, 60, 0)));
+				std::this_thread::sleep_for(interval / 2);
+			}
+
+			injector.done = true;
+		});
+	}
+
+	inline void latency_join(LatencyInjector& injector) {
+		injector.stop = true;
+
+		if (injector.thread.joinable()) {
+			injector.thread.join();
+		}
+	}
+
+	inline LatencyInjector::~LatencyInjector() {
+		latency_join(*this);
+	}
+}  // namespace vizzy
+
+#endif
@@ -1,12 +1,21 @@
 #ifndef VIZZY_LOG_HPP
 #define VIZZY_LOG_HPP
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <string_view>
 #include <optional>
+#include <vector>
 
 #include <filesystem>
 #include <iostream>
+#include <condition_variable>
+#include <iterator>
+#include <mutex>
+#include <thread>
 
 #include <fmt/core.h>
 #include <fmt/format.h>
@@ -15,6 +24,7 @@
 #include <fmt/ostream.h>
 
 #include <vizzy/macro.hpp>
+#include <vizzy/ring.hpp>
 
 // Logging
 namespace vizzy {
@@ -123,91 +133,460 @@ namespace vizzy {
 template <>
 struct fmt::formatter<vizzy::LogKind>: fmt::ostream_formatter {};
 
+// Log levels
+// VIZZY_LOG_LEVEL is the lowest level compiled in, anything below it is removed from the log macros
+// along with the evaluation of their arguments. `log_set_level` can raise it further at runtime,
+// which is checked before anything is formatted.
+#ifndef VIZZY_LOG_LEVEL
+#define VIZZY_LOG_LEVEL Debug
+#endif
+
+namespace vizzy {
+	enum class LogLevel {
+		Debug,
+		Info,
+		Warn,
+		Error,
+	};
+
+	inline constexpr LogLevel log_level_compiled = LogLevel::VIZZY_LOG_LEVEL;
+
+	[[nodiscard]] constexpr LogLevel log_level(LogKind kind) {
+		switch (kind) {
+			case LogKind::Debug:
+			case LogKind::Trace:
+			case LogKind::Function: return LogLevel::Debug;
+			case LogKind::Okay: return LogLevel::Info;
+			case LogKind::Warn: return LogLevel::Warn;
+
+			// Expr and Here are only ever added while debugging something, never hide them.
+			case LogKind::Error:
+			case LogKind::Expr:
+			case LogKind::Here: return LogLevel::Error;
+		}
+
+		return LogLevel::Error;
+	}
+
+	[[nodiscard]] inline std::optional<LogLevel> log_level_from_str(std::string_view sv) {
+		if (sv == "debug") {
+			return LogLevel::Debug;
+		}
+
+		if (sv == "info") {
+			return LogLevel::Info;
+		}
+
+		if (sv == "warn") {
+			return LogLevel::Warn;
+		}
+
+		if (sv == "error") {
+			return LogLevel::Error;
+		}
+
+		return std::nullopt;
+	}
+
+	namespace detail {
+		inline std::atomic<LogLevel> log_level_runtime = LogLevel::Debug;
+	}
+
+	[[nodiscard]] constexpr bool log_compiled(LogKind kind) {
+		return log_level(kind) >= log_level_compiled;
+	}
+
+	[[nodiscard]] inline bool log_enabled(LogKind kind) {
+		return log_compiled(kind) and log_level(kind) >= detail::log_level_runtime.load(std::memory_order_relaxed);
+	}
+
+	inline void log_set_level(LogLevel level) {
+		detail::log_level_runtime.store(level, std::memory_order_relaxed);
+	}
+}  // namespace vizzy
+
+// Source locations
+// VIZZY_ROOT is the project directory with a trailing slash, stripped from __FILE__ at compile time.
+#ifndef VIZZY_ROOT
+#define VIZZY_ROOT ""
+#endif
+
 namespace vizzy {
 
 	struct LogInfo {
-		std::string_view file;
+		std::string_view file;  // Relative to VIZZY_ROOT.
 		std::string_view line;
 		std::string_view func;
 	};
 
+	namespace detail {
+		[[nodiscard]] consteval std::string_view log_relative(std::string_view file) {
+			std::string_view root = VIZZY_ROOT;
+			return file.starts_with(root) ? file.substr(root.size()) : file;
+		}
+	}  // namespace detail
+
+#define VIZZY_LOG_INFO(func) \
+	vizzy::LogInfo { \
+		vizzy::detail::log_relative(VIZZY_LOCATION_FILE), VIZZY_LOCATION_LINE, func \
+	}
+
 	namespace detail {
 		// Case where we have a format string and additional argument.
 		template <typename T, typename... Ts>
-		inline decltype(auto) log_fmt(std::ostream& os, std::string_view fmt, T&& arg, Ts&&... args) {
-			fmt::print(os, fmt::runtime(fmt), std::forward<T>(arg), std::forward<Ts>(args)...);
+		inline decltype(auto) log_fmt(fmt::memory_buffer& out, std::string_view fmt, T&& arg, Ts&&... args) {
+			fmt::format_to(std::back_inserter(out), fmt::runtime(fmt), std::forward<T>(arg), std::forward<Ts>(args)...);
 		}
 
 		// First argument is not a string but we still want to print it so we supply default format string.
 		template <typename T>
-		inline decltype(auto) log_fmt(std::ostream& os, T&& arg) {
-			fmt::print(os, "{}", std::forward<T>(arg));
+		inline decltype(auto) log_fmt(fmt::memory_buffer& out, T&& arg) {
+			fmt::format_to(std::back_inserter(out), "{}", std::forward<T>(arg));
+		}
+
+		inline void log_header(fmt::memory_buffer& out, LogKind kind, std::optional<LogInfo> info, bool message) {
+			auto colour = vizzy::log_colour_to_str(kind);
+			auto sigil = vizzy::log_to_str(kind);
+			auto human = vizzy::log_human_to_str(kind);
+
+			fmt::format_to(std::back_inserter(out),
+				"{}[{}]" VIZZY_RESET
+				" "
+				"{}[{}]" VIZZY_RESET " ",
+				colour,
+				sigil,
+				colour,
+				human);
+
+			if (info.has_value()) {
+				auto [file, line, func] = info.value();
+
+				std::string_view func_name = func == "operator()" ? "<lamba>" : func;
+				std::string_view separator = message ? VIZZY_FG_BLACK_BRIGHT "│" VIZZY_RESET : "";
+
+				fmt::format_to(std::back_inserter(out),
+					"`" VIZZY_BOLD "{}" VIZZY_RESET "` " VIZZY_FG_BLACK_BRIGHT "│" VIZZY_RESET " ",
+					func_name);
+
+				fmt::format_to(std::back_inserter(out),
+					VIZZY_FG_BLACK_BRIGHT "({}:{})" VIZZY_RESET " {} ",
+					file,
+					line,
+					separator);
+			}
 		}
 	}  // namespace detail
 
+	// Formats and writes on the calling thread.
 	template <typename... Ts>
 	inline decltype(auto) log(std::ostream& os, LogKind kind, std::optional<LogInfo> info, Ts&&... args) {
-		auto colour = vizzy::log_colour_to_str(kind);
-		auto sigil = vizzy::log_to_str(kind);
-		auto human = vizzy::log_human_to_str(kind);
+		fmt::memory_buffer out;
+
+		detail::log_header(out, kind, info, sizeof...(Ts) > 0);
+
+		if constexpr (sizeof...(Ts) > 0) {
+			detail::log_fmt(out, std::forward<Ts>(args)...);
+		}
+
+		out.push_back('\n');
+		os.write(out.data(), static_cast<std::streamsize>(out.size()));
+	}
+}  // namespace vizzy
+
+// Asynchronous logging
+// Once `log_start` has been called, logging to stderr only formats the message into a fixed size
+// buffer and pushes it onto a ring owned by the calling thread, a writer thread adds the header and
+// does the actual I/O. That keeps terminal writes out of the MIDI callback and render loop. Memory is
+// bounded by the number of rings, when a ring is full or every ring is taken the message is dropped
+// and counted instead of blocking. Before `log_start` everything is written synchronously.
+namespace vizzy {
+	inline constexpr size_t log_text_size = 192;  // Longer messages are split over several records.
+	inline constexpr size_t log_ring_size = 1024;
+	inline constexpr size_t log_max_threads = 16;
+
+	// Output is for humans, nothing needs it any sooner unless a ring is filling up.
+	inline constexpr auto log_interval = std::chrono::milliseconds { 5 };
+
+	struct LogRecord {
+		LogKind kind = LogKind::Debug;
+
+		bool first = true;  // Starts a message, the writer prints the header.
+		bool continued = false;  // Text carries on in the next record.
+		bool message = false;  // Whether there were any arguments.
+		bool located = false;  // Whether `info` is set.
+
+		uint16_t length = 0;
+
+		LogInfo info;  // Views of string literals from the log macros.
+		std::array<char, log_text_size> text;
+	};
+
+	namespace detail {
+		struct LogProducer {
+			Ring<LogRecord, log_ring_size> ring;
+			std::atomic<bool> owned = false;  // Rings are handed to a new thread once the old one exits.
+
+			fmt::memory_buffer pending;  // Writer side, message still waiting for its last record.
+		};
+
+		struct LogBackend {
+			std::array<std::atomic<LogProducer*>, log_max_threads> producers {};
+			std::mutex registering;
+
+			std::mutex writing;  // Held by whoever is draining, `log_flush` may run on any thread.
+			std::thread thread;
+
+			std::mutex sleeping;
+			std::condition_variable wake;  // Only notified once a ring is half full.
+			std::atomic<bool> urgent = false;  // Set with that notification, the writer drains right away.
+
+			std::atomic<bool> running = false;
+			std::atomic<bool> stop = false;
+
+			std::atomic<size_t> dropped = 0;
+			size_t reported = 0;  // Drops already written out.
+
+			~LogBackend();
+		};
+
+		inline LogBackend log_backend;
 
-		fmt::print(os,
-			"{}[{}]" VIZZY_RESET
-			" "
-			"{}[{}]" VIZZY_RESET " ",
-			colour,
-			sigil,
-			colour,
-			human);
+		// Releases the calling thread's ring when it exits.
+		struct LogLocal {
+			LogProducer* producer = nullptr;
 
-		if (info.has_value()) {
-			auto [file, line, func] = info.value();
+			~LogLocal() {
+				if (producer != nullptr) {
+					producer->owned.store(false, std::memory_order_release);
+				}
+			}
+		};
 
-			std::string_view func_name = func == "operator()" ? "<lamba>" : func;
-			std::string_view separator = (sizeof...(Ts) > 0) ? VIZZY_FG_BLACK_BRIGHT "│" VIZZY_RESET : "";
+		inline thread_local LogLocal log_local;
 
-			auto path = std::filesystem::relative(file).native();
+		[[nodiscard]] inline LogProducer* log_acquire() {
+			std::lock_guard lock { log_backend.registering };
 
-			fmt::print(os, "`" VIZZY_BOLD "{}" VIZZY_RESET "` " VIZZY_FG_BLACK_BRIGHT "│" VIZZY_RESET " ", func_name);
-			fmt::print(os, VIZZY_FG_BLACK_BRIGHT "({}:{})" VIZZY_RESET " {} ", path, line, separator);
+			for (auto& slot: log_backend.producers) {
+				LogProducer* producer = slot.load(std::memory_order_acquire);
+
+				if (producer == nullptr) {
+					producer = new LogProducer {};
+					producer->owned.store(true, std::memory_order_relaxed);
+
+					slot.store(producer, std::memory_order_release);
+					return producer;
+				}
+
+				bool expected = false;
+
+				if (producer->owned.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+					return producer;
+				}
+			}
+
+			return nullptr;
 		}
 
-		if constexpr (sizeof...(Ts) > 0) {
-			detail::log_fmt(os, std::forward<Ts>(args)...);
+		template <typename... Ts>
+		inline void log_submit(LogKind kind, std::optional<LogInfo> info, Ts&&... args) {
+			if (not log_enabled(kind)) {
+				return;
+			}
+
+			if (not log_backend.running.load(std::memory_order_acquire)) {
+				log(std::cerr, kind, info, std::forward<Ts>(args)...);
+				return;
+			}
+
+			LogProducer*& producer = log_local.producer;
+
+			if (producer == nullptr and (producer = log_acquire()) == nullptr) {
+				log_backend.dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			// Only spills onto the heap for very long messages.
+			fmt::memory_buffer text;
+
+			if constexpr (sizeof...(Ts) > 0) {
+				log_fmt(text, std::forward<Ts>(args)...);
+			}
+
+			size_t records = std::max<size_t>(1, (text.size() + log_text_size - 1) / log_text_size);
+
+			// All or nothing so the writer never waits on the rest of a message that was dropped.
+			if (ring_space(producer->ring) < records) {
+				log_backend.dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			for (size_t i = 0; i != records; ++i) {
+				size_t offset = i * log_text_size;
+				size_t length = std::min(log_text_size, text.size() - std::min(offset, text.size()));
+
+				LogRecord record {
+					.kind = kind,
+					.first = i == 0,
+					.continued = i + 1 != records,
+					.message = sizeof...(Ts) > 0,
+					.located = info.has_value(),
+					.length = static_cast<uint16_t>(length),
+					.info = info.value_or(LogInfo {}),
+					.text = {},
+				};
+
+				std::copy_n(text.data() + std::min(offset, text.size()), length, record.text.data());
+				(void)ring_push(producer->ring, record);
+			}
+
+			// One notification per wake is enough, the writer clears `urgent` before draining.
+			if (ring_space(producer->ring) < log_ring_size / 2
+				and not log_backend.urgent.exchange(true, std::memory_order_acq_rel)) {
+				log_backend.wake.notify_one();
+			}
 		}
 
-		fmt::print(os, "\n");
+		// Caller holds `log_backend.writing`.
+		inline void log_drain() {
+			fmt::memory_buffer out;
+
+			for (auto& slot: log_backend.producers) {
+				LogProducer* producer = slot.load(std::memory_order_acquire);
+
+				if (producer == nullptr) {
+					continue;
+				}
+
+				ring_drain(producer->ring, [&](const LogRecord& record) {
+					auto& pending = producer->pending;
+
+					if (record.first) {
+						std::optional<LogInfo> info;
+
+						if (record.located) {
+							info = record.info;
+						}
+
+						pending.clear();
+						log_header(pending, record.kind, info, record.message);
+					}
+
+					pending.append(record.text.data(), record.text.data() + record.length);
+
+					if (not record.continued) {
+						pending.push_back('\n');
+						out.append(pending.data(), pending.data() + pending.size());
+						pending.clear();
+					}
+				});
+			}
+
+			if (size_t dropped = log_backend.dropped.load(std::memory_order_relaxed); dropped != log_backend.reported) {
+				log_header(out, LogKind::Warn, std::nullopt, true);
+				fmt::format_to(std::back_inserter(out), "dropped {} log messages\n", dropped - log_backend.reported);
+
+				log_backend.reported = dropped;
+			}
+
+			if (out.size() != 0) {
+				std::cerr.write(out.data(), static_cast<std::streamsize>(out.size()));
+				std::cerr.flush();
+			}
+		}
+
+		inline void log_writer() {
+			while (not log_backend.stop.load(std::memory_order_relaxed)) {
+				// Cleared first so a ring filling up during the drain wakes the writer again.
+				log_backend.urgent.store(false, std::memory_order_release);
+
+				{
+					std::lock_guard lock { log_backend.writing };
+					log_drain();
+				}
+
+				std::unique_lock lock { log_backend.sleeping };
+
+				// Producers don't take `sleeping`, so a notification can still land between the check and
+				// the wait. That costs at most one `log_interval`.
+				log_backend.wake.wait_for(lock, log_interval, [] {
+					return log_backend.stop.load(std::memory_order_relaxed)
+						or log_backend.urgent.load(std::memory_order_acquire);
+				});
+			}
+		}
+	}  // namespace detail
+
+	inline void log_start() {
+		if (detail::log_backend.thread.joinable()) {
+			return;
+		}
+
+		detail::log_backend.stop = false;
+		detail::log_backend.thread = std::thread(detail::log_writer);
+		detail::log_backend.running.store(true, std::memory_order_release);
+	}
+
+	// Writes out everything pushed so far, used before dying so the error comes last.
+	inline void log_flush() {
+		if (not detail::log_backend.running.load(std::memory_order_acquire)) {
+			return;
+		}
+
+		std::lock_guard lock { detail::log_backend.writing };
+		detail::log_drain();
+	}
+
+	// Other threads should have stopped logging by now, anything they push afterwards is lost.
+	inline void log_stop() {
+		if (not detail::log_backend.thread.joinable()) {
+			return;
+		}
+
+		detail::log_backend.running.store(false, std::memory_order_release);
+		detail::log_backend.stop = true;
+		detail::log_backend.wake.notify_one();
+		detail::log_backend.thread.join();
+
+		std::lock_guard lock { detail::log_backend.writing };
+		detail::log_drain();
+	}
+
+	inline detail::LogBackend::~LogBackend() {
+		log_stop();
+
+		for (auto& slot: producers) {
+			delete slot.load(std::memory_order_relaxed);
+		}
 	}
 
 	template <typename... Ts>
 	inline decltype(auto) log(LogKind kind, std::optional<LogInfo> info, Ts&&... args) {
-		return log(std::cerr, kind, info, std::forward<Ts>(args)...);
+		return detail::log_submit(kind, info, std::forward<Ts>(args)...);
 	}
 
 	template <typename... Ts>
 	inline decltype(auto) log(LogKind kind, Ts&&... args) {
-		return log(std::cerr, kind, std::nullopt, std::forward<Ts>(args)...);
+		return detail::log_submit(kind, std::nullopt, std::forward<Ts>(args)...);
 	}
 
 	namespace detail {
 		template <typename T>
-		inline decltype(auto) inspect(
-			std::ostream& os, std::optional<LogInfo> info, std::string_view expr_str, T&& expr) {
-			log(os, LogKind::Expr, info, "{} = {}", expr_str, std::forward<T>(expr));
+		inline decltype(auto) inspect(std::optional<LogInfo> info, std::string_view expr_str, T&& expr) {
+			log_submit(LogKind::Expr, info, "{} = {}", expr_str, std::forward<T>(expr));
 			return std::forward<T>(expr);
 		}
 	}
 
-// Log with file location info included.
-#define VIZZY_LOG(...) \
+// Log with file location info included. `kind` must be a constant, levels below VIZZY_LOG_LEVEL
+// compile to nothing and the arguments are only evaluated if the level is enabled.
+#define VIZZY_LOG(kind, ...) \
 	do { \
-		[VIZZY_VAR(func) = VIZZY_LOCATION_FUNC]<typename... VIZZY_VAR(Ts)>( \
-			vizzy::LogKind VIZZY_VAR(kind), VIZZY_VAR(Ts)&&... VIZZY_VAR(args)) { \
-			vizzy::log(std::cerr, \
-				VIZZY_VAR(kind), \
-				vizzy::LogInfo { VIZZY_LOCATION_FILE, VIZZY_LOCATION_LINE, VIZZY_VAR(func) }, \
-				std::forward<VIZZY_VAR(Ts)>(VIZZY_VAR(args))...); \
-		}(__VA_ARGS__); \
+		if constexpr (vizzy::log_compiled(kind)) { \
+			if (vizzy::log_enabled(kind)) { \
+				vizzy::detail::log_submit(kind, VIZZY_LOG_INFO(VIZZY_LOCATION_FUNC) __VA_OPT__(, ) __VA_ARGS__); \
+			} \
+		} \
 	} while (0)
 
 // Unfortunately these convenience macros require at least one argument due to quirk of __VA_ARGS__.
@@ -245,10 +624,7 @@ namespace vizzy {
 // expression without needing to create temporary variables)
 #define VIZZY_INSPECT(expr) \
 	[&, VIZZY_VAR(func) = VIZZY_LOCATION_FUNC]() { \
-		return vizzy::detail::inspect(std::cerr, \
-			vizzy::LogInfo { VIZZY_LOCATION_FILE, VIZZY_LOCATION_LINE, VIZZY_VAR(func) }, \
-			VIZZY_STR(expr), \
-			(expr)); \
+		return vizzy::detail::inspect(VIZZY_LOG_INFO(VIZZY_VAR(func)), VIZZY_STR(expr), (expr)); \
 	}()
 
 // The printf debuggers dream
@@ -262,4 +638,76 @@ namespace vizzy {
 
 }  // namespace vizzy
 
+// Profiling
+// Zones are recorded into a preallocated array and only written out at exit (see profile.hpp).
+// While profiling is off a zone is a single branch on construction and destruction.
+namespace vizzy {
+	enum class ProfileTrack : uint32_t {
+		Cpu = 1,
+		Gpu = 2,
+	};
+
+	struct ProfileEvent {
+		const char* name;  // Must outlive the profiler, zones only take string literals.
+		int64_t begin;  // Nanoseconds on the steady clock.
+		int64_t end;
+		ProfileTrack track;
+	};
+
+	namespace detail {
+		inline constexpr size_t profile_capacity = 1 << 20;
+
+		inline bool profile_enabled = false;
+		inline std::vector<ProfileEvent> profile_events;
+		inline size_t profile_dropped = 0;
+	}  // namespace detail
+
+	[[nodiscard]] inline int64_t profile_now() {
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+	}
+
+	inline void profile_enable() {
+		detail::profile_events.reserve(detail::profile_capacity);
+		detail::profile_enabled = true;
+	}
+
+	[[nodiscard]] inline bool profile_enabled() {
+		return detail::profile_enabled;
+	}
+
+	inline void profile_record(const char* name, int64_t begin, int64_t end, ProfileTrack track) {
+		if (detail::profile_events.size() == detail::profile_capacity) {
+			detail::profile_dropped++;
+			return;
+		}
+
+		detail::profile_events.push_back({ name, begin, end, track });
+	}
+
+	// Only used from the render thread.
+	struct ProfileZone {
+		const char* name;
+		int64_t begin = -1;
+
+		ProfileZone(const char* name_): name(name_) {
+			if (detail::profile_enabled) {
+				begin = profile_now();
+			}
+		}
+
+		~ProfileZone() {
+			if (begin != -1) {
+				profile_record(name, begin, profile_now(), ProfileTrack::Cpu);
+			}
+		}
+
+		ProfileZone(const ProfileZone&) = delete;
+		ProfileZone& operator=(const ProfileZone&) = delete;
+	};
+
+// Time the rest of the enclosing scope.
+#define VIZZY_ZONE(name) vizzy::ProfileZone VIZZY_VAR(zone) { name }
+}  // namespace vizzy
+
 #endif
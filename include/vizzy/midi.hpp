@@ -0,0 +1,339 @@
+#ifndef VIZZY_MIDI_HPP
+#define VIZZY_MIDI_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include <libremidi/message.hpp>
+
+#include <vizzy/ring.hpp>
+#include <vizzy/log.hpp>
+#include <vizzy/util.hpp>
+
+// MIDI events
+namespace vizzy {
+	// Compact copy of a channel message that can be passed between threads without allocating.
+	// System exclusive and other variable length messages are not representable and are ignored.
+	struct MidiEvent {
+		int64_t timestamp = 0;  // As reported by libremidi, nanoseconds.
+		int64_t received = 0;  // vizzy::clock ticks when the callback saw it.
+
+		uint8_t status = 0;
+		uint8_t data1 = 0;
+		uint8_t data2 = 0;
+		uint8_t port = 0;
+
+		// Mirrors the libremidi::message interface so patterns read the same for both.
+		[[nodiscard]] libremidi::message_type get_message_type() const {
+			if (status >= static_cast<uint8_t>(libremidi::message_type::SYSTEM_EXCLUSIVE)) {
+				return static_cast<libremidi::message_type>(status);
+			}
+
+			return static_cast<libremidi::message_type>(status & 0xF0);
+		}
+
+		[[nodiscard]] int get_channel() const {
+			if (status >= static_cast<uint8_t>(libremidi::message_type::SYSTEM_EXCLUSIVE)) {
+				return 0;
+			}
+
+			return (status & 0x0F) + 1;
+		}
+	};
+
+	inline std::ostream& operator<<(std::ostream& os, const MidiEvent& ev) {
+		fmt::print(os,
+			fmt::runtime("{{ .timestamp={}, .received={}, .status={:#04x}, .data1={}, .data2={}, .port={} }}"),
+			ev.timestamp,
+			ev.received,
+			ev.status,
+			ev.data1,
+			ev.data2,
+			ev.port);
+
+		return os;
+	}
+}  // namespace vizzy
+
+template <>
+struct fmt::formatter<vizzy::MidiEvent>: fmt::ostream_formatter {};
+
+namespace vizzy {
+	[[nodiscard]] inline std::optional<MidiEvent> midi_event(
+		const libremidi::message& msg, uint8_t port, vizzy::timepoint received) {
+		if (msg.size() == 0 or msg.size() > 3) {
+			return std::nullopt;
+		}
+
+		return MidiEvent {
+			.timestamp = msg.timestamp,
+			.received = received.time_since_epoch().count(),
+			.status = msg[0],
+			.data1 = static_cast<uint8_t>(msg.size() > 1 ? msg[1] : 0),
+			.data2 = static_cast<uint8_t>(msg.size() > 2 ? msg[2] : 0),
+			.port = port,
+		};
+	}
+}  // namespace vizzy
+
+// Declarative matching
+namespace vizzy {
+	// Describes a set of channel messages. Unlike an arbitrary predicate this can be expanded ahead of
+	// time into the (status, data1) pairs it accepts, see `MidiRoutes`.
+	struct MidiMatch {
+		libremidi::message_type type = libremidi::message_type::NOTE_ON;
+
+		uint16_t channels = 0xFFFF;  // Bit `n` accepts channel `n + 1`.
+
+		uint8_t data1_min = 0;  // Note, controller or program number.
+		uint8_t data1_max = 127;
+
+		uint8_t data2_min = 0;  // Velocity, controller value or pressure.
+		uint8_t data2_max = 127;
+	};
+
+	[[nodiscard]] constexpr uint16_t midi_channel(int channel) {
+		return static_cast<uint16_t>(1u << (channel - 1));
+	}
+
+	[[nodiscard]] inline bool midi_matches(const MidiMatch& match, const MidiEvent& ev) {
+		int channel = ev.get_channel();
+
+		return ev.get_message_type() == match.type and channel != 0 and (match.channels & midi_channel(channel)) and
+			ev.data1 >= match.data1_min and ev.data1 <= match.data1_max and ev.data2 >= match.data2_min and
+			ev.data2 <= match.data2_max;
+	}
+
+	inline std::ostream& operator<<(std::ostream& os, const MidiMatch& match) {
+		fmt::print(os,
+			fmt::runtime("{{ .type={:#04x}, .channels={:#06x}, .data1=[{}, {}], .data2=[{}, {}] }}"),
+			static_cast<uint8_t>(match.type),
+			match.channels,
+			match.data1_min,
+			match.data1_max,
+			match.data2_min,
+			match.data2_max);
+
+		return os;
+	}
+}  // namespace vizzy
+
+template <>
+struct fmt::formatter<vizzy::MidiMatch>: fmt::ostream_formatter {};
+
+// Routing
+namespace vizzy {
+	// Index from (status byte, data1) to the targets whose match accepts it, stored as one flat array
+	// with an offset table (CSR) so a lookup is two loads and a contiguous scan. data2 is range
+	// checked per target since it rarely narrows anything.
+	struct MidiRoutes {
+		static constexpr size_t keys = 256 * 128;
+
+		std::vector<uint32_t> offsets = std::vector<uint32_t>(keys + 1, 0);
+		std::vector<uint32_t> targets;
+	};
+
+	[[nodiscard]] inline size_t midi_route_key(uint8_t status, uint8_t data1) {
+		return status * 128 + (data1 & 0x7F);
+	}
+
+	// `matches[i]` describes target `i`, targets without a match are left out of the index.
+	[[nodiscard]] inline MidiRoutes midi_routes(const std::vector<std::optional<MidiMatch>>& matches) {
+		MidiRoutes routes;
+
+		auto for_each_key = [&](const MidiMatch& match, auto&& fn) {
+			auto type = static_cast<uint8_t>(match.type);
+
+			// Only channel voice messages carry a channel in their status byte.
+			if (type < 0x80 or type >= 0xF0) {
+				return;
+			}
+
+			for (int channel = 1; channel <= 16; ++channel) {
+				if (not(match.channels & midi_channel(channel))) {
+					continue;
+				}
+
+				for (int data1 = match.data1_min; data1 <= std::min<int>(match.data1_max, 127); ++data1) {
+					fn(midi_route_key(static_cast<uint8_t>(type | (channel - 1)), static_cast<uint8_t>(data1)));
+				}
+			}
+		};
+
+		// Count, prefix sum, then fill.
+		for (const auto& match: matches) {
+			if (match.has_value()) {
+				for_each_key(match.value(), [&](size_t key) { routes.offsets[key + 1]++; });
+			}
+		}
+
+		for (size_t key = 0; key != MidiRoutes::keys; ++key) {
+			routes.offsets[key + 1] += routes.offsets[key];
+		}
+
+		routes.targets.resize(routes.offsets.back());
+		std::vector<uint32_t> cursor { routes.offsets.begin(), routes.offsets.end() - 1 };
+
+		for (size_t i = 0; i != matches.size(); ++i) {
+			if (matches[i].has_value()) {
+				for_each_key(matches[i].value(), [&](size_t key) { routes.targets[cursor[key]++] = static_cast<uint32_t>(i); });
+			}
+		}
+
+		return routes;
+	}
+
+	// Targets that may be affected by `ev`. Callers still need to check data2.
+	[[nodiscard]] inline std::span<const uint32_t> midi_route(const MidiRoutes& routes, const MidiEvent& ev) {
+		size_t key = midi_route_key(ev.status, ev.data1);
+		return { routes.targets.data() + routes.offsets[key], routes.targets.data() + routes.offsets[key + 1] };
+	}
+}  // namespace vizzy
+
+// Queue between the MIDI input thread and the render thread.
+namespace vizzy {
+	inline constexpr size_t midi_queue_capacity = 4096;
+
+	struct MidiQueue {
+		vizzy::Ring<MidiEvent, midi_queue_capacity> ring;
+
+		std::atomic<size_t> dropped = 0;  // Written by the producer, read by the consumer.
+		size_t dropped_reported = 0;  // Consumer only.
+	};
+
+	// Called from the MIDI thread. Never blocks or allocates.
+	inline void midi_push(MidiQueue& queue, const libremidi::message& msg, uint8_t port) {
+		auto ev = midi_event(msg, port, vizzy::clock::now());
+
+		if (not ev.has_value()) {
+			return;
+		}
+
+		if (not vizzy::ring_push(queue.ring, ev.value())) {
+			queue.dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// Called from the render thread once per frame.
+	template <typename F>
+	inline size_t midi_drain(MidiQueue& queue, F&& fn) {
+		size_t count = vizzy::ring_drain(queue.ring, std::forward<F>(fn));
+
+		if (size_t dropped = queue.dropped.load(std::memory_order_relaxed); dropped != queue.dropped_reported) {
+			VIZZY_WARN("midi queue full, dropped {} events", dropped - queue.dropped_reported);
+			queue.dropped_reported = dropped;
+		}
+
+		return count;
+	}
+}  // namespace vizzy
+
+// Timing
+// libremidi stamps messages when the driver delivered them which is earlier and far less jittery than
+// whenever our callback got scheduled. Those timestamps live on the backend's own clock so we learn an
+// offset onto vizzy::clock from the callback arrival times.
+namespace vizzy {
+	inline constexpr size_t midi_clock_window = 128;
+
+	struct MidiClock {
+		// Arrival minus timestamp for recent events. Scheduling delay only ever adds to this so the
+		// smallest recent sample is the best estimate of the true offset, and a window rather than an
+		// all-time minimum lets it follow drift between the two clocks.
+		std::array<int64_t, midi_clock_window> samples {};
+		size_t sample_count = 0;
+
+		int64_t offset = 0;
+
+		// Shift every trigger into the future by this much. Trades latency for all events landing on
+		// the frame they were scheduled for even when the callback ran late.
+		vizzy::clock::duration lookahead {};
+	};
+
+	// Maps an event onto vizzy::clock, including lookahead.
+	[[nodiscard]] inline vizzy::timepoint midi_time(MidiClock& clock, const MidiEvent& ev) {
+		using ns = std::chrono::nanoseconds;
+
+		auto received = vizzy::timepoint { vizzy::clock::duration { ev.received } };
+
+		// Backend didn't give us anything to work with.
+		if (ev.timestamp == 0) {
+			return received + clock.lookahead;
+		}
+
+		int64_t timestamp = std::chrono::duration_cast<vizzy::clock::duration>(ns { ev.timestamp }).count();
+
+		clock.samples[clock.sample_count++ % midi_clock_window] = ev.received - timestamp;
+
+		size_t n = std::min(clock.sample_count, midi_clock_window);
+		clock.offset = *std::min_element(clock.samples.begin(), clock.samples.begin() + n);
+
+		return vizzy::timepoint { vizzy::clock::duration { timestamp + clock.offset } } + clock.lookahead;
+	}
+}  // namespace vizzy
+
+// Skew measurement
+// Distribution of how late a trigger is first seen by the renderer, enabled with `--skew`.
+namespace vizzy {
+	struct SkewStats {
+		std::vector<vizzy::timepoint> pending;  // Triggers not rendered yet.
+		std::vector<vizzy::clock::duration> samples;
+	};
+
+	inline void skew_trigger(SkewStats& stats, vizzy::timepoint trigger) {
+		stats.pending.push_back(trigger);
+	}
+
+	// Call with the time envelopes were evaluated at for the frame.
+	inline void skew_frame(SkewStats& stats, vizzy::timepoint frame_time) {
+		std::erase_if(stats.pending, [&](vizzy::timepoint trigger) {
+			if (trigger > frame_time) {
+				return false;
+			}
+
+			stats.samples.push_back(frame_time - trigger);
+			return true;
+		});
+	}
+
+	inline void skew_report(SkewStats& stats) {
+		using ms = std::chrono::duration<double, std::milli>;
+
+		if (stats.samples.empty()) {
+			VIZZY_WARN("no triggers were rendered");
+			return;
+		}
+
+		auto min = *std::min_element(stats.samples.begin(), stats.samples.end());
+		auto max = *std::max_element(stats.samples.begin(), stats.samples.end());
+
+		VIZZY_OKAY(
+			"trigger-to-render skew over {} triggers: min = {:.3f}ms, p50 = {:.3f}ms, p90 = {:.3f}ms, p99 = {:.3f}ms, "
+			"max = {:.3f}ms",
+			stats.samples.size(),
+			ms(min).count(),
+			ms(vizzy::percentile(stats.samples, .5)).count(),
+			ms(vizzy::percentile(stats.samples, .9)).count(),
+			ms(vizzy::percentile(stats.samples, .99)).count(),
+			ms(max).count());
+
+		// Coarse histogram in 1ms buckets, everything past the last bucket is lumped together.
+		constexpr size_t buckets = 20;
+		std::array<size_t, buckets + 1> histogram {};
+
+		for (auto sample: stats.samples) {
+			histogram[std::min(static_cast<size_t>(ms(sample).count()), buckets)]++;
+		}
+
+		for (size_t i = 0; i != histogram.size(); ++i) {
+			if (histogram[i] != 0) {
+				vizzy::log(LogKind::Okay, "{:>3}{}ms {:>8}", i, i == buckets ? "+" : " ", histogram[i]);
+			}
+		}
+	}
+}  // namespace vizzy
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef VIZZY_OFFLINE_HPP
+#define VIZZY_OFFLINE_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include <libremidi/reader.hpp>
+
+#include <vizzy/util.hpp>
+#include <vizzy/gl.hpp>
+#include <vizzy/midi.hpp>
+
+// Standard MIDI Files
+namespace vizzy {
+	struct TimedEvent {
+		vizzy::clock::duration time;  // From the start of the file.
+		vizzy::MidiEvent event;
+	};
+
+	// Every channel message in a file, sorted by time with tempo changes already applied.
+	struct Timeline {
+		std::vector<TimedEvent> events;
+		vizzy::clock::duration length {};
+	};
+
+	[[nodiscard]] inline Timeline read_timeline(std::filesystem::path path) {
+		VIZZY_FUNCTION();
+
+		std::string bytes = vizzy::read_file(path);
+
+		libremidi::reader reader;
+		auto result = reader.parse(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+
+		if (result == libremidi::reader::invalid) {
+			vizzy::die("cannot parse MIDI file '{}'", path.string());
+		}
+
+		if (result == libremidi::reader::incomplete) {
+			VIZZY_WARN("MIDI file '{}' is incomplete", path.string());
+		}
+
+		// Track events carry delta ticks, make them absolute and merge all tracks so tempo changes
+		// (usually on the first track) apply to everything after them.
+		struct Tick {
+			int64_t tick;
+			const libremidi::message* msg;
+		};
+
+		std::vector<Tick> ticks;
+
+		for (size_t track = 0; track != reader.tracks.size(); ++track) {
+			int64_t tick = 0;
+
+			for (const auto& ev: reader.tracks[track]) {
+				tick += ev.tick;
+				ticks.push_back({ tick, &ev.m });
+			}
+		}
+
+		std::stable_sort(ticks.begin(), ticks.end(), [](const Tick& a, const Tick& b) { return a.tick < b.tick; });
+
+		double ticks_per_beat = reader.ticksPerBeat > 0 ? reader.ticksPerBeat : 480.0;
+		double us_per_beat = 500000.0;  // 120bpm until told otherwise.
+
+		double seconds = 0.0;
+		int64_t last_tick = 0;
+
+		Timeline timeline;
+
+		for (auto [tick, msg]: ticks) {
+			seconds += static_cast<double>(tick - last_tick) * us_per_beat / ticks_per_beat / 1e6;
+			last_tick = tick;
+
+			std::chrono::duration<double> time { seconds };
+
+			if (msg->is_meta_event()) {
+				// Tempo is the last three bytes, microseconds per quarter note.
+				if (msg->get_meta_event_type() == libremidi::meta_event_type::TEMPO_CHANGE and msg->size() >= 5) {
+					size_t n = msg->size();
+					us_per_beat = static_cast<double>(((*msg)[n - 3] << 16) | ((*msg)[n - 2] << 8) | (*msg)[n - 1]);
+				}
+
+				continue;
+			}
+
+			auto ev = vizzy::midi_event(*msg, 0, vizzy::timepoint {});
+
+			if (not ev.has_value()) {
+				continue;
+			}
+
+			timeline.events.push_back({ std::chrono::duration_cast<vizzy::clock::duration>(time), ev.value() });
+		}
+
+		timeline.length = std::chrono::duration_cast<vizzy::clock::duration>(std::chrono::duration<double> { seconds });
+
+		VIZZY_OKAY("read {} events over {:.2f}s from '{}'", timeline.events.size(), seconds, path.string());
+
+		return timeline;
+	}
+}  // namespace vizzy
+
+// Offscreen targets
+namespace vizzy::gl {
+	struct Target {
+		FramebufferHandle framebuffer {};
+		RenderbufferHandle colour {};
+
+		int width = 0;
+		int height = 0;
+	};
+
+	[[nodiscard]] inline Target create_target(int width, int height) {
+		VIZZY_FUNCTION();
+
+		Target target { .width = width, .height = height };
+
+		call(glCreateRenderbuffers, 1, &target.colour.id);
+		call(glNamedRenderbufferStorage, target.colour, GL_RGBA8, width, height);
+
+		call(glCreateFramebuffers, 1, &target.framebuffer.id);
+		call(glNamedFramebufferRenderbuffer, target.framebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.colour);
+
+		if (GLenum status = glCheckNamedFramebufferStatus(target.framebuffer, GL_FRAMEBUFFER); status != GL_FRAMEBUFFER_COMPLETE) {
+			vizzy::die("framebuffer incomplete! status = {:#x}", status);
+		}
+
+		VIZZY_OKAY("successfully created {}x{} target ({})", width, height, target.framebuffer);
+
+		return target;
+	}
+
+	inline void destroy_target(Target& target) {
+		target = {};
+	}
+}  // namespace vizzy::gl
+
+// Frame capture
+// Readback goes through a pair of pixel buffers so the copy for frame N overlaps rendering frame N+1
+// instead of stalling on glReadPixels.
+namespace vizzy {
+	struct FrameWriter {
+		std::filesystem::path directory;
+
+		std::array<gl::BufferHandle, 2> buffers {};
+		std::array<int64_t, 2> frames { -1, -1 };  // Frame number waiting in each buffer.
+
+		int width = 0;
+		int height = 0;
+
+		size_t next = 0;
+		size_t written = 0;
+	};
+
+	[[nodiscard]] inline FrameWriter create_frame_writer(std::filesystem::path directory, int width, int height) {
+		VIZZY_FUNCTION();
+
+		std::error_code ec;
+		std::filesystem::create_directories(directory, ec);
+
+		if (ec) {
+			vizzy::die("cannot create '{}': {}", directory.string(), ec.message());
+		}
+
+		FrameWriter writer { .directory = directory, .width = width, .height = height };
+
+		size_t size = static_cast<size_t>(width) * height * 3;
+
+		for (auto& buffer: writer.buffers) {
+			vizzy::gl::call(glCreateBuffers, 1, &buffer.id);
+			vizzy::gl::call(glNamedBufferStorage, buffer, size, nullptr, GL_MAP_READ_BIT);
+		}
+
+		return writer;
+	}
+
+	namespace detail {
+		inline void frame_save(FrameWriter& writer, size_t slot) {
+			size_t stride = static_cast<size_t>(writer.width) * 3;
+			size_t size = stride * writer.height;
+
+			auto* pixels = static_cast<const uint8_t*>(glMapNamedBufferRange(writer.buffers[slot], 0, size, GL_MAP_READ_BIT));
+
+			if (pixels == nullptr) {
+				vizzy::die("glMapNamedBufferRange failed!");
+			}
+
+			auto path = writer.directory / fmt::format("frame_{:06}.ppm", writer.frames[slot]);
+			std::ofstream os { path, std::ios::binary };
+
+			if (not os.is_open()) {
+				vizzy::die("cannot write '{}'", path.string());
+			}
+
+			// PPM is top to bottom, GL is bottom to top.
+			fmt::print(os, "P6\n{} {}\n255\n", writer.width, writer.height);
+
+			for (int y = writer.height; y != 0; --y) {
+				os.write(reinterpret_cast<const char*>(pixels + (y - 1) * stride), static_cast<std::streamsize>(stride));
+			}
+
+			glUnmapNamedBuffer(writer.buffers[slot]);
+
+			writer.frames[slot] = -1;
+			writer.written++;
+		}
+	}  // namespace detail
+
+	// Queue a readback of `framebuffer` into the next buffer, first writing out the frame that buffer still
+	// holds, the one queued two calls ago.
+	inline void frame_capture(FrameWriter& writer, GLuint framebuffer, int64_t frame) {
+		size_t slot = writer.next;
+
+		if (writer.frames[slot] != -1) {
+			detail::frame_save(writer, slot);
+		}
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, writer.buffers[slot]);
+
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, writer.width, writer.height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+		writer.frames[slot] = frame;
+		writer.next = (slot + 1) % writer.buffers.size();
+	}
+
+	// Write whatever is still in flight and release the buffers.
+	inline void destroy_frame_writer(FrameWriter& writer) {
+		for (size_t i = 0; i != writer.buffers.size(); ++i) {
+			size_t slot = (writer.next + i) % writer.buffers.size();
+
+			if (writer.frames[slot] != -1) {
+				detail::frame_save(writer, slot);
+			}
+		}
+
+		writer.buffers = {};
+	}
+}  // namespace vizzy
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef VIZZY_PACING_HPP
+#define VIZZY_PACING_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include <vizzy/util.hpp>
+#include <vizzy/log.hpp>
+#include <vizzy/context.hpp>
+
+// Frame pacing
+// INFO: https://www.khronos.org/opengl/wiki/Swap_Interval#GPU_vs_CPU_synchronization
+// Rendering as soon as the previous swap returns means input and envelopes are sampled right after a
+// vblank and then sit in a finished frame until the next one. Instead the pacer learns the refresh
+// interval and how long a frame takes from sampling to the GPU finishing it, sleeps until just
+// before the latest point that still makes the next vblank and predicts when that frame will be
+// shown, so envelopes are evaluated for the moment they're on screen.
+//
+// Waiting for the GPU before and after every swap keeps at most one frame in flight, which is what
+// makes both measurements mean anything. The time the post-swap fence signals stands in for vblank,
+// there's no portable presentation timestamp through SDL. A frame shown more than half an interval
+// after its prediction counts as missed and widens the safety margin, which then slowly shrinks back.
+//
+// With vsync off nothing waits, frames are predicted to show once they've been drawn.
+namespace vizzy {
+	inline constexpr size_t pacer_window = 64;  // Cost samples the estimate is taken from.
+	inline constexpr size_t pacer_report_window = 4096;  // Most recent frames `pacer_report` covers.
+	inline constexpr auto pacer_fallback_interval = std::chrono::microseconds { 16'667 };
+
+	inline constexpr auto pacer_min_margin = std::chrono::microseconds { 500 };
+	inline constexpr auto pacer_margin_grow = std::chrono::microseconds { 500 };
+	inline constexpr auto pacer_margin_shrink = std::chrono::microseconds { 100 };
+	inline constexpr size_t pacer_shrink_after = 240;  // Frames on time before the margin shrinks.
+
+	struct FramePacer {
+		Vsync vsync = Vsync::On;
+
+		vizzy::clock::duration interval = pacer_fallback_interval;  // Learned refresh interval.
+		vizzy::clock::duration margin = pacer_min_margin;
+
+		std::optional<vizzy::timepoint> vblank;  // Last presentation, the grid predictions are made on.
+
+		std::array<vizzy::clock::duration, pacer_window> costs {};  // Sample to GPU finished.
+		std::array<vizzy::clock::duration, pacer_window> scratch {};  // Reordered by `pacer_cost`.
+		size_t cost_count = 0;
+
+		vizzy::timepoint latch;  // When the current frame started sampling.
+		vizzy::timepoint target;  // When the current frame is predicted to be shown.
+
+		size_t on_time = 0;  // Since the last miss.
+
+		// Counters
+		uint64_t frames = 0;
+		uint64_t missed = 0;
+
+		// Rings like `costs`, so a long session doesn't grow them.
+		std::vector<vizzy::clock::duration> latency;  // Latch to presentation.
+		std::vector<vizzy::clock::duration> error;  // Presentation minus prediction, absolute.
+		size_t presented = 0;
+	};
+
+	[[nodiscard]] inline FramePacer create_frame_pacer(const Context& context, Vsync vsync) {
+		FramePacer pacer;
+
+		pacer.vsync = vsync;
+		pacer.latency.resize(pacer_report_window);
+		pacer.error.resize(pacer_report_window);
+		pacer.interval = context_refresh_interval(context).value_or(pacer_fallback_interval);
+
+		std::chrono::duration<double> interval = pacer.interval;
+		VIZZY_DEBUG("vsync = {}, refresh = {:.2f}Hz", vsync_str(vsync), 1.0 / interval.count());
+
+		return pacer;
+	}
+
+	namespace detail {
+		inline void pacer_fence() {
+			GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
+			glDeleteSync(fence);
+		}
+
+		// Pessimistic so the occasional slow frame doesn't miss.
+		[[nodiscard]] inline vizzy::clock::duration pacer_cost(FramePacer& pacer) {
+			size_t n = std::min(pacer.cost_count, pacer_window);
+
+			std::copy_n(pacer.costs.begin(), n, pacer.scratch.begin());
+			return vizzy::percentile(std::span { pacer.scratch.data(), n }, .95);
+		}
+
+		inline void pacer_sample_cost(FramePacer& pacer, vizzy::clock::duration cost) {
+			pacer.costs[pacer.cost_count++ % pacer_window] = cost;
+		}
+	}  // namespace detail
+
+	// Call right before sampling input. Sleeps if there's time to spare and returns when the frame is
+	// expected to be shown, which is the time to evaluate envelopes at.
+	[[nodiscard]] inline vizzy::timepoint pacer_wait(FramePacer& pacer) {
+		auto now = vizzy::clock::now();
+		auto cost = detail::pacer_cost(pacer);
+
+		if (pacer.vsync == Vsync::Off or not pacer.vblank) {
+			// Uncapped frames are measured latch to latch.
+			if (pacer.vsync == Vsync::Off and pacer.frames != 0) {
+				detail::pacer_sample_cost(pacer, now - pacer.latch);
+			}
+
+			pacer.latch = now;
+			pacer.target = now + cost;
+
+			return pacer.target;
+		}
+
+		cost += pacer.margin;
+
+		// First vblank that can still be made.
+		auto since = now + cost - *pacer.vblank;
+		auto intervals = std::max<int64_t>((since + pacer.interval - vizzy::clock::duration { 1 }) / pacer.interval, 1);
+
+		pacer.target = *pacer.vblank + pacer.interval * intervals;
+
+		if (auto wake = pacer.target - cost; wake > now) {
+			std::this_thread::sleep_until(wake);
+		}
+
+		pacer.latch = vizzy::clock::now();
+
+		return pacer.target;
+	}
+
+	// Call after drawing and before swapping.
+	inline void pacer_rendered(FramePacer& pacer) {
+		if (pacer.vsync == Vsync::Off) {
+			return;
+		}
+
+		detail::pacer_fence();
+		detail::pacer_sample_cost(pacer, vizzy::clock::now() - pacer.latch);
+	}
+
+	// Call right after swapping.
+	inline void pacer_presented(FramePacer& pacer) {
+		pacer.frames++;
+
+		if (pacer.vsync == Vsync::Off) {
+			return;
+		}
+
+		detail::pacer_fence();
+
+		auto presented = vizzy::clock::now();
+
+		if (pacer.vblank) {
+			auto delta = presented - *pacer.vblank;
+			auto intervals = std::llround(std::chrono::duration<double>(delta) / pacer.interval);
+
+			// Refine the interval from presentations that landed close to the grid.
+			if (intervals >= 1) {
+				auto sample = delta / intervals;
+
+				if (sample > pacer.interval * 9 / 10 and sample < pacer.interval * 11 / 10) {
+					pacer.interval += (sample - pacer.interval) / 16;
+				}
+			}
+
+			size_t slot = pacer.presented++ % pacer_report_window;
+
+			pacer.latency[slot] = presented - pacer.latch;
+			pacer.error[slot] = presented > pacer.target ? presented - pacer.target : pacer.target - presented;
+
+			if (presented > pacer.target + pacer.interval / 2) {
+				pacer.missed++;
+				pacer.on_time = 0;
+				pacer.margin = std::min<vizzy::clock::duration>(pacer.margin + pacer_margin_grow, pacer.interval / 2);
+			}
+
+			else if (++pacer.on_time % pacer_shrink_after == 0) {
+				pacer.margin = std::max<vizzy::clock::duration>(pacer.margin - pacer_margin_shrink, pacer_min_margin);
+			}
+		}
+
+		pacer.vblank = presented;
+	}
+
+	inline void pacer_report(FramePacer& pacer) {
+		using ms = std::chrono::duration<double, std::milli>;
+
+		std::chrono::duration<double> interval = pacer.interval;
+
+		VIZZY_OKAY(
+			"pacing: vsync = {}, refresh = {:.2f}Hz, cost = {:.2f}ms, margin = {:.2f}ms, missed = {}/{} frames",
+			vsync_str(pacer.vsync),
+			1.0 / interval.count(),
+			ms(detail::pacer_cost(pacer)).count(),
+			ms(pacer.margin).count(),
+			pacer.missed,
+			pacer.frames);
+
+		size_t n = std::min(pacer.presented, pacer_report_window);
+
+		if (n == 0) {
+			return;
+		}
+
+		std::span latency { pacer.latency.data(), n };
+		std::span error { pacer.error.data(), n };
+
+		VIZZY_OKAY(
+			"pacing: latch-to-present p50 = {:.2f}ms, p99 = {:.2f}ms, prediction error p50 = {:.2f}ms, "
+			"p99 = {:.2f}ms (last {} frames)",
+			ms(vizzy::percentile(latency, .5)).count(),
+			ms(vizzy::percentile(latency, .99)).count(),
+			ms(vizzy::percentile(error, .5)).count(),
+			ms(vizzy::percentile(error, .99)).count(),
+			n);
+	}
+}  // namespace vizzy
+
+#endif
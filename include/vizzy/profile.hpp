@@ -0,0 +1,221 @@
+#ifndef VIZZY_PROFILE_HPP
+#define VIZZY_PROFILE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include <vizzy/util.hpp>
+#include <vizzy/log.hpp>
+#include <vizzy/gl.hpp>
+
+// GPU profiling
+// Each zone writes a pair of GL_TIMESTAMP queries. Results are collected when a frame's slot comes
+// back around `gpu_profile_latency` frames later, by which point the GPU has long finished with it.
+// Timestamps rather than GL_TIME_ELAPSED so zones can nest.
+namespace vizzy::gl {
+	inline constexpr size_t gpu_profile_latency = 4;
+
+	struct GpuQuery {
+		const char* name;
+		GLuint begin;
+		GLuint end;
+	};
+
+	struct GpuProfiler {
+		std::array<std::vector<GpuQuery>, gpu_profile_latency> frames;
+		std::vector<GLuint> free;  // Query objects not waiting on a result.
+
+		size_t frame = 0;
+		int64_t offset = 0;  // Add to a GPU timestamp to get steady clock nanoseconds.
+
+		size_t stalls = 0;  // Results that weren't ready when their slot was reused.
+		bool enabled = false;
+	};
+
+	[[nodiscard]] inline GpuProfiler create_gpu_profiler() {
+		VIZZY_FUNCTION();
+
+		GpuProfiler profiler;
+
+		if (not vizzy::profile_enabled()) {
+			return profiler;
+		}
+
+		profiler.enabled = true;
+
+		// Enough for a handful of zones per frame, more are created on demand.
+		profiler.free.resize(gpu_profile_latency * 16);
+		call(glGenQueries, static_cast<GLsizei>(profiler.free.size()), profiler.free.data());
+
+		// Both clocks are monotonic so a single offset is good enough over the length of a trace.
+		GLint64 gpu = 0;
+		call(glGetInteger64v, GL_TIMESTAMP, &gpu);
+		profiler.offset = vizzy::profile_now() - gpu;
+
+		VIZZY_DEBUG("queries = {}, offset = {}ns", profiler.free.size(), profiler.offset);
+
+		return profiler;
+	}
+
+	namespace detail {
+		inline void gpu_collect(GpuProfiler& profiler, std::vector<GpuQuery>& queries) {
+			for (auto [name, begin, end]: queries) {
+				GLint available = GL_FALSE;
+				glGetQueryObjectiv(end, GL_QUERY_RESULT_AVAILABLE, &available);
+
+				if (available == GL_FALSE) {
+					profiler.stalls++;
+				}
+
+				GLint64 begin_ns = 0;
+				GLint64 end_ns = 0;
+
+				glGetQueryObjecti64v(begin, GL_QUERY_RESULT, &begin_ns);
+				glGetQueryObjecti64v(end, GL_QUERY_RESULT, &end_ns);
+
+				vizzy::profile_record(name, begin_ns + profiler.offset, end_ns + profiler.offset, vizzy::ProfileTrack::Gpu);
+
+				profiler.free.push_back(begin);
+				profiler.free.push_back(end);
+			}
+
+			queries.clear();
+		}
+
+		[[nodiscard]] inline GLuint gpu_query(GpuProfiler& profiler) {
+			if (profiler.free.empty()) {
+				GLuint query;
+				glGenQueries(1, &query);
+				return query;
+			}
+
+			GLuint query = profiler.free.back();
+			profiler.free.pop_back();
+
+			return query;
+		}
+	}  // namespace detail
+
+	// Call once at the start of every frame.
+	inline void gpu_frame_begin(GpuProfiler& profiler) {
+		if (not profiler.enabled) {
+			return;
+		}
+
+		profiler.frame = (profiler.frame + 1) % gpu_profile_latency;
+		detail::gpu_collect(profiler, profiler.frames[profiler.frame]);
+	}
+
+	[[nodiscard]] inline size_t gpu_zone_begin(GpuProfiler& profiler, const char* name) {
+		auto& queries = profiler.frames[profiler.frame];
+
+		GpuQuery query { name, detail::gpu_query(profiler), 0 };
+		glQueryCounter(query.begin, GL_TIMESTAMP);
+
+		queries.push_back(query);
+		return queries.size() - 1;
+	}
+
+	inline void gpu_zone_end(GpuProfiler& profiler, size_t index) {
+		GpuQuery& query = profiler.frames[profiler.frame][index];
+
+		query.end = detail::gpu_query(profiler);
+		glQueryCounter(query.end, GL_TIMESTAMP);
+	}
+
+	// Waits for everything still in flight.
+	inline void destroy_gpu_profiler(GpuProfiler& profiler) {
+		if (not profiler.enabled) {
+			return;
+		}
+
+		for (size_t i = 1; i <= gpu_profile_latency; ++i) {
+			detail::gpu_collect(profiler, profiler.frames[(profiler.frame + i) % gpu_profile_latency]);
+		}
+
+		if (profiler.stalls != 0) {
+			VIZZY_WARN("{} GPU zones were waited on", profiler.stalls);
+		}
+
+		glDeleteQueries(static_cast<GLsizei>(profiler.free.size()), profiler.free.data());
+		profiler = {};
+	}
+
+	struct GpuZone {
+		GpuProfiler& profiler;
+		size_t index = 0;
+
+		GpuZone(GpuProfiler& profiler_, const char* name): profiler(profiler_) {
+			if (profiler.enabled) {
+				index = gpu_zone_begin(profiler, name);
+			}
+		}
+
+		~GpuZone() {
+			if (profiler.enabled) {
+				gpu_zone_end(profiler, index);
+			}
+		}
+
+		GpuZone(const GpuZone&) = delete;
+		GpuZone& operator=(const GpuZone&) = delete;
+	};
+
+// Time the GPU work submitted in the rest of the enclosing scope.
+#define VIZZY_GPU_ZONE(profiler, name) vizzy::gl::GpuZone VIZZY_VAR(gpu_zone) { profiler, name }
+}  // namespace vizzy::gl
+
+// Trace export
+// INFO: https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+// Complete ("X") events, loadable in chrome://tracing and ui.perfetto.dev.
+namespace vizzy {
+	inline void profile_write_trace(std::filesystem::path path) {
+		VIZZY_FUNCTION();
+
+		auto& events = detail::profile_events;
+
+		if (events.empty()) {
+			VIZZY_WARN("no profile events recorded");
+			return;
+		}
+
+		std::ofstream os { path };
+
+		if (not os.is_open()) {
+			vizzy::die("cannot write '{}'", path.string());
+		}
+
+		int64_t origin = std::min_element(events.begin(), events.end(), [](const auto& a, const auto& b) {
+			return a.begin < b.begin;
+		})->begin;
+
+		fmt::print(os, "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		fmt::print(os, "{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{{\"name\":\"CPU\"}}}},\n");
+		fmt::print(os, "{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{{\"name\":\"GPU\"}}}}");
+
+		for (const auto& [name, begin, end, track]: events) {
+			fmt::print(os,
+				",\n{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+				name,
+				static_cast<uint32_t>(track),
+				static_cast<double>(begin - origin) / 1e3,
+				static_cast<double>(end - begin) / 1e3);
+		}
+
+		fmt::print(os, "\n]}}\n");
+
+		if (detail::profile_dropped != 0) {
+			VIZZY_WARN("{} profile events dropped, trace is truncated", detail::profile_dropped);
+		}
+
+		VIZZY_OKAY("wrote {} events to '{}'", events.size(), path.string());
+	}
+}  // namespace vizzy
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef VIZZY_RING_HPP
+#define VIZZY_RING_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <optional>
+#include <type_traits>
+
+// Lock-free queues
+namespace vizzy {
+	// Keep producer and consumer indices on separate cache lines so the two threads don't
+	// fight over the same line every time one of them moves.
+	inline constexpr size_t cacheline_size = 64;
+
+	// Bounded single-producer/single-consumer ring. Exactly one thread may push and exactly
+	// one (other) thread may pop. Storage is inline so pushing never allocates.
+	template <typename T, size_t N>
+		requires std::is_trivially_copyable_v<T> and ((N & (N - 1)) == 0) and (N > 0)
+	struct Ring {
+		alignas(cacheline_size) std::atomic<size_t> head = 0;  // Next slot to read (owned by consumer).
+		alignas(cacheline_size) std::atomic<size_t> tail = 0;  // Next slot to write (owned by producer).
+
+		alignas(cacheline_size) std::array<T, N> slots {};
+
+		static constexpr size_t capacity = N;
+		static constexpr size_t mask = N - 1;
+	};
+
+	// Producer side. Returns false if the ring is full, in which case the value is dropped.
+	template <typename T, size_t N>
+	[[nodiscard]] inline bool ring_push(Ring<T, N>& ring, const T& value) {
+		size_t tail = ring.tail.load(std::memory_order_relaxed);
+		size_t head = ring.head.load(std::memory_order_acquire);
+
+		if (tail - head == N) {
+			return false;
+		}
+
+		ring.slots[tail & Ring<T, N>::mask] = value;
+		ring.tail.store(tail + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	// Producer side. Number of pushes guaranteed to succeed.
+	template <typename T, size_t N>
+	[[nodiscard]] inline size_t ring_space(Ring<T, N>& ring) {
+		size_t tail = ring.tail.load(std::memory_order_relaxed);
+		size_t head = ring.head.load(std::memory_order_acquire);
+
+		return N - (tail - head);
+	}
+
+	// Consumer side.
+	template <typename T, size_t N>
+	[[nodiscard]] inline std::optional<T> ring_pop(Ring<T, N>& ring) {
+		size_t head = ring.head.load(std::memory_order_relaxed);
+		size_t tail = ring.tail.load(std::memory_order_acquire);
+
+		if (head == tail) {
+			return std::nullopt;
+		}
+
+		T value = ring.slots[head & Ring<T, N>::mask];
+		ring.head.store(head + 1, std::memory_order_release);
+
+		return value;
+	}
+
+	// Consumer side. Hands every element that was in the ring at the time of the call to `fn`
+	// and releases all of the slots at once. Returns the number of elements consumed.
+	template <typename T, size_t N, typename F>
+	inline size_t ring_drain(Ring<T, N>& ring, F&& fn) {
+		size_t head = ring.head.load(std::memory_order_relaxed);
+		size_t tail = ring.tail.load(std::memory_order_acquire);
+
+		for (size_t i = head; i != tail; ++i) {
+			fn(ring.slots[i & Ring<T, N>::mask]);
+		}
+
+		ring.head.store(tail, std::memory_order_release);
+
+		return tail - head;
+	}
+
+	// Single-producer/single-consumer latest value. The producer fills the back slot and publishes it,
+	// the consumer picks up whichever slot was published last. Neither side ever waits and the
+	// consumer never sees a slot while it's being written, intermediate values are simply skipped.
+	// Slots are reused so a producer should overwrite the whole value.
+	template <typename T>
+	struct TripleBuffer {
+		static constexpr uint8_t fresh = 4;  // Set on `middle` when it holds a value the consumer hasn't seen.
+
+		std::array<T, 3> slots {};
+
+		alignas(cacheline_size) std::atomic<uint8_t> middle = 1;
+		alignas(cacheline_size) uint8_t back = 0;  // Owned by producer.
+		alignas(cacheline_size) uint8_t front = 2;  // Owned by consumer.
+	};
+
+	// Producer side. Slot to fill before calling `triple_publish`.
+	template <typename T>
+	[[nodiscard]] inline T& triple_back(TripleBuffer<T>& buffer) {
+		return buffer.slots[buffer.back];
+	}
+
+	template <typename T>
+	inline void triple_publish(TripleBuffer<T>& buffer) {
+		uint8_t previous = buffer.middle.exchange(buffer.back | TripleBuffer<T>::fresh, std::memory_order_acq_rel);
+		buffer.back = previous & ~TripleBuffer<T>::fresh;
+	}
+
+	// Consumer side. Moves to the most recently published value, returns false if there was none since
+	// the last call.
+	template <typename T>
+	inline bool triple_update(TripleBuffer<T>& buffer) {
+		if ((buffer.middle.load(std::memory_order_relaxed) & TripleBuffer<T>::fresh) == 0) {
+			return false;
+		}
+
+		uint8_t previous = buffer.middle.exchange(buffer.front, std::memory_order_acq_rel);
+		buffer.front = previous & ~TripleBuffer<T>::fresh;
+
+		return true;
+	}
+
+	// Consumer side. Value picked up by the last `triple_update`.
+	template <typename T>
+	[[nodiscard]] inline const T& triple_front(const TripleBuffer<T>& buffer) {
+		return buffer.slots[buffer.front];
+	}
+}  // namespace vizzy
+
+#endif
@@ -0,0 +1,750 @@
+#ifndef VIZZY_SCENE_HPP
+#define VIZZY_SCENE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sol/sol.hpp>
+
+#include <vizzy/util.hpp>
+#include <vizzy/log.hpp>
+#include <vizzy/ring.hpp>
+#include <vizzy/arena.hpp>
+#include <vizzy/midi.hpp>
+#include <vizzy/bank.hpp>
+#include <vizzy/gl.hpp>
+
+// Buffer views
+// INFO: https://www.lua.org/manual/5.1/manual.html#3.7
+// Every value crossing sol2's bindings goes through a checked conversion, which adds up quickly for a
+// script touching hundreds of envelopes or a value per note every tick. A view exposes a float array
+// to Lua as userdata whose methods are raw C functions that move whole ranges per call:
+//
+//   view:get(i), view:set(i, v)    single values, indices are 1-based like tables
+//   view:fill(v, [first, count])
+//   view:read([first, count])      new table holding the range
+//   view:write(t, [first])         copies the array part of `t` into the view
+//   #view
+//   view:pointer()                 light userdata for `ffi.cast("float*", ...)` under LuaJIT, 0-based
+//                                  and only valid until the current callback returns, writable views only
+namespace vizzy {
+	struct FloatView {
+		float* data = nullptr;
+		size_t size = 0;
+		bool writable = false;
+	};
+
+	namespace detail {
+		// Lua errors unwind with longjmp when it's built as C, so nothing below may hold anything with a
+		// destructor across a call that can raise one.
+		[[nodiscard]] inline FloatView& view_self(lua_State* L) {
+			if (not sol::stack::check<FloatView>(L, 1)) {
+				luaL_argerror(L, 1, "expected FloatView");
+			}
+
+			return *sol::stack::get<FloatView*>(L, 1);
+		}
+
+		[[nodiscard]] inline size_t view_index(lua_State* L, const FloatView& view, int arg) {
+			lua_Integer i = luaL_checkinteger(L, arg);
+
+			if (i < 1 or static_cast<size_t>(i) > view.size) {
+				luaL_error(L, "index %d out of range for view of %d", static_cast<int>(i), static_cast<int>(view.size));
+			}
+
+			return static_cast<size_t>(i - 1);
+		}
+
+		// Optional `first` and `count` at `arg`, defaulting to the rest of the view. Returns a 0-based range.
+		[[nodiscard]] inline std::pair<size_t, size_t> view_range(lua_State* L, const FloatView& view, int arg) {
+			lua_Integer size = static_cast<lua_Integer>(view.size);
+			lua_Integer first = luaL_optinteger(L, arg, 1);
+			lua_Integer count = luaL_optinteger(L, arg + 1, size - first + 1);
+
+			if (first < 1 or count < 0 or first - 1 + count > size) {
+				luaL_error(L,
+					"range [%d, %d] out of range for view of %d",
+					static_cast<int>(first),
+					static_cast<int>(first + count - 1),
+					static_cast<int>(size));
+			}
+
+			return { static_cast<size_t>(first - 1), static_cast<size_t>(count) };
+		}
+
+		inline void view_check_writable(lua_State* L, const FloatView& view) {
+			if (not view.writable) {
+				luaL_error(L, "view is read-only");
+			}
+		}
+
+		inline int view_get(lua_State* L) {
+			auto& view = view_self(L);
+			lua_pushnumber(L, view.data[view_index(L, view, 2)]);
+
+			return 1;
+		}
+
+		inline int view_set(lua_State* L) {
+			auto& view = view_self(L);
+			view_check_writable(L, view);
+
+			size_t i = view_index(L, view, 2);
+			view.data[i] = static_cast<float>(luaL_checknumber(L, 3));
+
+			return 0;
+		}
+
+		inline int view_fill(lua_State* L) {
+			auto& view = view_self(L);
+			view_check_writable(L, view);
+
+			auto value = static_cast<float>(luaL_checknumber(L, 2));
+			auto [first, count] = view_range(L, view, 3);
+
+			std::fill_n(view.data + first, count, value);
+
+			return 0;
+		}
+
+		inline int view_read(lua_State* L) {
+			auto& view = view_self(L);
+			auto [first, count] = view_range(L, view, 2);
+
+			lua_createtable(L, static_cast<int>(count), 0);
+
+			for (size_t i = 0; i != count; ++i) {
+				lua_pushnumber(L, view.data[first + i]);
+				lua_rawseti(L, -2, static_cast<int>(i + 1));
+			}
+
+			return 1;
+		}
+
+		// Values that aren't numbers are written as 0.
+		inline int view_write(lua_State* L) {
+			auto& view = view_self(L);
+			view_check_writable(L, view);
+
+			luaL_checktype(L, 2, LUA_TTABLE);
+
+			auto count = static_cast<size_t>(lua_rawlen(L, 2));
+			lua_Integer first = luaL_optinteger(L, 3, 1);
+
+			if (first < 1 or static_cast<size_t>(first - 1) + count > view.size) {
+				luaL_error(L,
+					"writing %d values at %d overflows view of %d",
+					static_cast<int>(count),
+					static_cast<int>(first),
+					static_cast<int>(view.size));
+			}
+
+			float* out = view.data + (first - 1);
+
+			for (size_t i = 0; i != count; ++i) {
+				lua_rawgeti(L, 2, static_cast<int>(i + 1));
+				out[i] = static_cast<float>(lua_tonumber(L, -1));
+				lua_pop(L, 1);
+			}
+
+			return 0;
+		}
+
+		inline int view_size(lua_State* L) {
+			lua_pushinteger(L, static_cast<lua_Integer>(view_self(L).size));
+			return 1;
+		}
+
+		// Raw memory can't be made read-only, so read-only views don't hand it out.
+		inline int view_pointer(lua_State* L) {
+			auto& view = view_self(L);
+			view_check_writable(L, view);
+
+			lua_pushlightuserdata(L, view.data);
+			return 1;
+		}
+	}  // namespace detail
+
+	// Views are pushed as pointers, Lua never owns one.
+	inline void view_register(sol::state& lua) {
+		lua.new_usertype<FloatView>("FloatView",
+			sol::no_constructor,
+			"get",
+			&detail::view_get,
+			"set",
+			&detail::view_set,
+			"fill",
+			&detail::view_fill,
+			"read",
+			&detail::view_read,
+			"write",
+			&detail::view_write,
+			"size",
+			&detail::view_size,
+			"pointer",
+			&detail::view_pointer,
+			sol::meta_function::length,
+			&detail::view_size);
+	}
+}  // namespace vizzy
+
+// Budgeted garbage collection
+// INFO: https://www.lua.org/manual/5.1/manual.html#2.10
+// Left to itself Lua collects whenever allocation crosses its threshold, which in a fixed rate loop
+// turns into a long pause every so often. With automatic collection stopped the owner calls `gc_step`
+// once per tick instead, which runs incremental steps until the budget is spent so collection costs
+// a bounded slice of every tick. Should garbage pile up faster than the budget clears it a full
+// collection is forced and counted.
+namespace vizzy {
+	inline constexpr auto gc_default_budget = std::chrono::microseconds { 500 };
+
+	// Heap size below which a collection is never forced.
+	inline constexpr size_t gc_floor = 8 * 1024 * 1024;
+
+	struct GcBudget {
+		vizzy::clock::duration budget = gc_default_budget;
+		size_t limit = gc_floor;  // Heap size that forces a full collection.
+
+		// Counters
+		uint64_t steps = 0;
+		uint64_t cycles = 0;
+		uint64_t forced = 0;
+		vizzy::clock::duration time {};
+		vizzy::clock::duration worst {};
+	};
+
+	[[nodiscard]] inline size_t gc_heap(lua_State* L) {
+		return static_cast<size_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + static_cast<size_t>(lua_gc(L, LUA_GCCOUNTB, 0));
+	}
+
+	// Stepping restarts automatic collection in Lua 5.1 so it's stopped again afterwards.
+	inline void gc_step(GcBudget& gc, lua_State* L) {
+		auto begin = vizzy::clock::now();
+		bool finished = false;
+
+		if (gc_heap(L) > gc.limit) {
+			lua_gc(L, LUA_GCCOLLECT, 0);
+
+			gc.forced++;
+			finished = true;
+		}
+
+		else {
+			for (auto deadline = begin + gc.budget; not finished and vizzy::clock::now() < deadline;) {
+				finished = lua_gc(L, LUA_GCSTEP, 0) == 1;
+				gc.steps++;
+			}
+		}
+
+		lua_gc(L, LUA_GCSTOP, 0);
+
+		if (finished) {
+			gc.cycles++;
+
+			// Collection just finished so the heap is about as small as it gets.
+			gc.limit = std::max(gc_heap(L) * 2, gc_floor);
+		}
+
+		auto elapsed = vizzy::clock::now() - begin;
+
+		gc.time += elapsed;
+		gc.worst = std::max(gc.worst, elapsed);
+	}
+}  // namespace vizzy
+
+// Lua scenes
+// INFO: https://sol2.readthedocs.io/en/latest/api/protected_function.html
+// Scene scripts run on their own thread against their own sol::state so a slow `on_update` or a
+// garbage collection pause costs the script a tick rather than the renderer a frame. Each tick
+// publishes a snapshot of the values the script set through a triple buffer and the render thread
+// applies whichever snapshot is newest without ever waiting. Going the other way, MIDI events are
+// forwarded through a ring and envelope levels through a second triple buffer.
+//
+// Scripts may define any of:
+//   on_load()                              after the script is (re)loaded
+//   on_update(t, dt)                       every tick, in seconds
+//   on_event(type, channel, data1, data2)  every MIDI channel message, `type` is e.g. "note_on"
+//
+// and call:
+//   vizzy.set(name, value)   set float uniform `name` in every stage that declares it
+//   vizzy.envelope(name)     current level of envelope `name`, 0 if there's no such envelope
+//
+// Scene states allocate from a size-class arena and every tick ends with a budgeted `gc_step`.
+//
+// For bulk access there are two views, `vizzy.envelopes` over every envelope level in bank order and
+// `vizzy.data`, `scene_data_size` floats that end up in `scene_data[]` in the frame block. Both are
+// backed by the scene's own buffers so reading or writing them costs nothing until the tick is
+// published.
+namespace vizzy {
+	inline constexpr size_t scene_data_size = 256;
+
+	inline constexpr auto scene_period = std::chrono::duration_cast<vizzy::clock::duration>(
+		std::chrono::duration<double> { 1.0 / 120.0 });
+
+	struct SceneValue {
+		std::string name;
+		float value = 0.f;
+	};
+
+	struct SceneSnapshot {
+		uint64_t tick = 0;
+		uint64_t generation = 0;  // Bumped by every reload, which may change the order of `values`.
+		vizzy::timepoint time;
+		std::vector<SceneValue> values;
+		std::vector<float> data;
+	};
+
+	struct Scene {
+		std::filesystem::path path;
+
+		// Only touched by the scene thread. Callbacks are declared after the state so they're released
+		// before it's closed, which has to happen before the arena goes.
+		Arena arena;
+		sol::state lua;
+		sol::protected_function on_update;
+		sol::protected_function on_event;
+
+		std::vector<SceneValue> values;  // Set so far in order, copied into every snapshot.
+		uint64_t generation = 0;
+		std::vector<float> data;  // Same, written through `data_view`.
+		std::vector<std::string_view> envelope_names;
+
+		// Handed to Lua by pointer. The envelope view is moved to the newest levels every tick.
+		FloatView envelope_view;
+		FloatView data_view;
+
+		vizzy::timepoint start;
+		vizzy::timepoint last;
+
+		// Render thread to scene thread.
+		Ring<MidiEvent, 256> events;
+		TripleBuffer<std::vector<float>> envelopes;
+
+		std::mutex reloading;
+		std::string source;  // Guarded by `reloading`.
+		std::atomic<bool> reload = false;
+
+		// Scene thread to render thread.
+		TripleBuffer<SceneSnapshot> snapshots;
+
+		std::thread thread;
+		std::atomic<bool> stop = false;
+
+		vizzy::clock::duration period = scene_period;
+		GcBudget gc;  // Scene thread only, read once it's stopped.
+
+		// Written by the scene thread, read when reporting.
+		std::atomic<uint64_t> ticks = 0;
+		std::atomic<uint64_t> overruns = 0;  // Ticks that took longer than `period`.
+		std::atomic<uint64_t> errors = 0;
+		std::atomic<int64_t> worst = 0;  // Longest tick, vizzy::clock ticks.
+
+		// Render thread only.
+		uint64_t dropped = 0;  // Events that didn't fit in `events`.
+		uint64_t frames = 0;
+		uint64_t stale = 0;  // Frames drawn without a new snapshot.
+
+		// Joins the thread if `destroy_scene` wasn't reached, e.g. when `vizzy::die` unwinds past it.
+		~Scene();
+	};
+
+	namespace detail {
+		[[nodiscard]] inline std::string_view scene_event_type(libremidi::message_type type) {
+			switch (type) {
+				case libremidi::message_type::NOTE_OFF: return "note_off";
+				case libremidi::message_type::NOTE_ON: return "note_on";
+				case libremidi::message_type::POLY_PRESSURE: return "poly_pressure";
+				case libremidi::message_type::CONTROL_CHANGE: return "control_change";
+				case libremidi::message_type::PROGRAM_CHANGE: return "program_change";
+				case libremidi::message_type::AFTERTOUCH: return "aftertouch";
+				case libremidi::message_type::PITCH_BEND: return "pitch_bend";
+				default: return "other";
+			}
+		}
+
+		// Logs the error and returns false if a call into Lua failed.
+		inline bool scene_check(Scene& scene, const sol::protected_function_result& result, std::string_view what) {
+			if (result.valid()) {
+				return true;
+			}
+
+			auto err = result.get<sol::error>();
+			VIZZY_ERROR("scene '{}' {}: {}", scene.path.string(), what, err.what());
+
+			scene.errors.fetch_add(1, std::memory_order_relaxed);
+
+			return false;
+		}
+
+		[[nodiscard]] inline sol::protected_function scene_callback(sol::state& lua, std::string_view name) {
+			sol::object object = lua[name];
+
+			if (object.get_type() != sol::type::function) {
+				return {};
+			}
+
+			return object.as<sol::protected_function>();
+		}
+
+		// Loads the script into a fresh state and only swaps it in if it runs, so a broken save keeps
+		// the previous scene going.
+		inline void scene_load(Scene& scene, const std::string& source) {
+			sol::state lua { sol::default_at_panic, arena_lua_alloc, &scene.arena };
+
+			// Only `gc_step` collects from here on.
+			lua_gc(lua.lua_state(), LUA_GCSTOP, 0);
+			// The FFI and JIT libraries are only opened when built against LuaJIT.
+			lua.open_libraries(sol::lib::base,
+				sol::lib::math,
+				sol::lib::string,
+				sol::lib::table,
+				sol::lib::ffi,
+				sol::lib::jit);
+
+			view_register(lua);
+
+			auto api = lua.create_named_table("vizzy");
+
+			api.set("envelopes", &scene.envelope_view);
+			api.set("data", &scene.data_view);
+
+			api.set_function("set", [&scene](std::string_view name, float value) {
+				auto it = std::ranges::find(scene.values, name, &SceneValue::name);
+
+				if (it == scene.values.end()) {
+					scene.values.push_back({ std::string { name }, value });
+					return;
+				}
+
+				it->value = value;
+			});
+
+			api.set_function("envelope", [&scene](std::string_view name) {
+				auto it = std::ranges::find(scene.envelope_names, name);
+
+				if (it == scene.envelope_names.end()) {
+					return 0.f;
+				}
+
+				return triple_front(scene.envelopes)[static_cast<size_t>(it - scene.envelope_names.begin())];
+			});
+
+			// Values from the previous script would otherwise stick around forever.
+			auto previous = std::exchange(scene.values, {});
+			auto previous_data = scene.data;
+
+			std::ranges::fill(scene.data, 0.f);
+
+			auto restore = [&] {
+				scene.values = std::move(previous);
+				std::ranges::copy(previous_data, scene.data.begin());
+
+				VIZZY_WARN("keeping previous scene");
+			};
+
+			auto chunk = "@" + scene.path.string();
+
+			if (not scene_check(scene, lua.safe_script(source, sol::script_pass_on_error, chunk), "load")) {
+				return restore();
+			}
+
+			auto on_load = scene_callback(lua, "on_load");
+
+			if (on_load and not scene_check(scene, on_load(), "on_load")) {
+				return restore();
+			}
+
+			// Release references into the old state before closing it.
+			scene.on_update = scene_callback(lua, "on_update");
+			scene.on_event = scene_callback(lua, "on_event");
+			scene.lua = std::move(lua);
+			scene.generation++;
+
+			VIZZY_DEBUG("loaded scene '{}'", scene.path.string());
+		}
+	}  // namespace detail
+
+	// Non-movable because the scene thread holds a reference, so it's set up in place. The script is
+	// read here but only run by the first tick.
+	inline void create_scene(Scene& scene, std::filesystem::path path, const EnvelopeBank& bank) {
+		VIZZY_FUNCTION();
+
+		scene.path = std::move(path);
+		scene.source = vizzy::read_file(scene.path);
+		scene.reload = true;
+
+		scene.envelope_names = bank.names;
+
+		for (auto& slot: scene.envelopes.slots) {
+			slot.assign(bank.names.size(), 0.f);
+		}
+
+		scene.data.assign(scene_data_size, 0.f);
+
+		for (auto& slot: scene.snapshots.slots) {
+			slot.data.assign(scene_data_size, 0.f);
+		}
+
+		// Valid from the start, the first tick may run `on_load` before the view is moved on.
+		scene.envelope_view = { const_cast<float*>(triple_front(scene.envelopes).data()), bank.names.size(), false };
+		scene.data_view = { scene.data.data(), scene.data.size(), true };
+	}
+
+	// Scene thread side, or the render thread when there's no scene thread. Runs one tick at `now`.
+	// Script errors are logged and the failing callback is skipped until the script is reloaded.
+	inline void scene_tick(Scene& scene, vizzy::timepoint now) {
+		uint64_t tick = scene.ticks.load(std::memory_order_relaxed);
+
+		if (tick == 0) {
+			scene.start = scene.last = now;
+		}
+
+		// Before loading so `on_load` already sees current levels.
+		triple_update(scene.envelopes);
+
+		// Never written through, the view isn't writable.
+		scene.envelope_view.data = const_cast<float*>(triple_front(scene.envelopes).data());
+
+		if (scene.reload.exchange(false, std::memory_order_acquire)) {
+			std::string source;
+
+			{
+				std::lock_guard lock { scene.reloading };
+				source = std::move(scene.source);
+			}
+
+			detail::scene_load(scene, source);
+		}
+
+		ring_drain(scene.events, [&](const MidiEvent& ev) {
+			if (not scene.on_event) {
+				return;
+			}
+
+			auto result = scene.on_event(
+				detail::scene_event_type(ev.get_message_type()), ev.get_channel(), ev.data1, ev.data2);
+
+			if (not detail::scene_check(scene, result, "on_event")) {
+				scene.on_event = {};
+			}
+		});
+
+		if (scene.on_update) {
+			std::chrono::duration<double> t = now - scene.start;
+			std::chrono::duration<double> dt = now - scene.last;
+
+			if (not detail::scene_check(scene, scene.on_update(t.count(), dt.count()), "on_update")) {
+				scene.on_update = {};
+			}
+		}
+
+		scene.last = now;
+
+		// Slots are reused, assigning keeps their strings' storage.
+		auto& snapshot = triple_back(scene.snapshots);
+
+		snapshot.tick = tick;
+		snapshot.generation = scene.generation;
+		snapshot.time = now;
+		snapshot.values.assign(scene.values.begin(), scene.values.end());
+		std::ranges::copy(scene.data, snapshot.data.begin());
+
+		triple_publish(scene.snapshots);
+
+		// After publishing so collection never delays a snapshot.
+		gc_step(scene.gc, scene.lua.lua_state());
+
+		scene.ticks.store(tick + 1, std::memory_order_relaxed);
+	}
+
+	namespace detail {
+		// Ticks on a fixed grid. A late tick isn't made up for, the grid restarts from when it finished.
+		inline void scene_thread(Scene& scene) {
+			auto next = vizzy::clock::now();
+
+			while (not scene.stop.load(std::memory_order_relaxed)) {
+				auto begin = vizzy::clock::now();
+
+				try {
+					scene_tick(scene, begin);
+				}
+
+				// sol2 turns Lua panics into exceptions, nothing may escape the thread.
+				catch (const std::exception& e) {
+					VIZZY_ERROR("scene '{}' failed: {}", scene.path.string(), e.what());
+
+					scene.errors.fetch_add(1, std::memory_order_relaxed);
+					scene.on_update = {};
+					scene.on_event = {};
+				}
+
+				auto end = vizzy::clock::now();
+				auto elapsed = end - begin;
+
+				if (elapsed.count() > scene.worst.load(std::memory_order_relaxed)) {
+					scene.worst.store(elapsed.count(), std::memory_order_relaxed);
+				}
+
+				next += scene.period;
+
+				if (next < end) {
+					scene.overruns.fetch_add(1, std::memory_order_relaxed);
+					next = end;
+				}
+
+				std::this_thread::sleep_until(next);
+			}
+		}
+	}  // namespace detail
+
+	inline void scene_start(Scene& scene) {
+		scene.thread = std::thread(detail::scene_thread, std::ref(scene));
+	}
+
+	inline void destroy_scene(Scene& scene) {
+		scene.stop = true;
+
+		if (scene.thread.joinable()) {
+			scene.thread.join();
+		}
+
+		scene.on_update = {};
+		scene.on_event = {};
+		scene.lua = {};
+
+		destroy_arena(scene.arena);
+	}
+
+	inline Scene::~Scene() {
+		destroy_scene(*this);
+	}
+
+	// Render thread side. Replaces the script with `source` on the next tick.
+	inline void scene_reload(Scene& scene, std::string source) {
+		{
+			std::lock_guard lock { scene.reloading };
+			scene.source = std::move(source);
+		}
+
+		scene.reload.store(true, std::memory_order_release);
+	}
+
+	// Render thread side. Forwards an event to `on_event`.
+	inline void scene_event(Scene& scene, const MidiEvent& ev) {
+		if (not ring_push(scene.events, ev)) {
+			scene.dropped++;
+		}
+	}
+
+	// Render thread side. Publishes envelope levels after `bank_update`.
+	inline void scene_envelopes(Scene& scene, const EnvelopeBank& bank) {
+		auto& levels = triple_back(scene.envelopes);
+		std::copy_n(bank.current_amplitudes.begin(), levels.size(), levels.begin());
+
+		triple_publish(scene.envelopes);
+	}
+
+	// Render thread side. Picks up the newest snapshot, once per frame before `scene_apply`.
+	inline void scene_frame(Scene& scene) {
+		if (not triple_update(scene.snapshots) and scene.frames != 0) {
+			scene.stale++;
+		}
+
+		scene.frames++;
+	}
+
+	// Render thread side. Data the script wrote through `vizzy.data` in the current snapshot.
+	[[nodiscard]] inline std::span<const float> scene_data(const Scene& scene) {
+		return triple_front(scene.snapshots).data;
+	}
+
+	// Render thread side. Locations of the snapshot's values in one program, by value index. Names are
+	// only looked up when a value first appears, so applying a snapshot does no string hashing.
+	struct SceneBinding {
+		uint64_t generation = 0;
+		std::vector<GLint> locations;  // -1 where the program doesn't declare a float of that name.
+	};
+
+	// Call whenever the bound program is replaced, e.g. when `stage_swap` returns true.
+	inline void scene_unbind(SceneBinding& binding) {
+		binding.locations.clear();
+	}
+
+	// Render thread side. Uploads the current snapshot to the float uniforms `program` declares, the
+	// rest are ignored so one script can drive stages that only use some of its values.
+	inline void scene_apply(const Scene& scene, SceneBinding& binding, const gl::Program& program) {
+		if (program.id == 0) {
+			return;
+		}
+
+		const auto& snapshot = triple_front(scene.snapshots);
+
+		// A reload starts the values over, possibly in a different order.
+		if (binding.generation != snapshot.generation) {
+			binding.generation = snapshot.generation;
+			scene_unbind(binding);
+		}
+
+		// Values are only ever appended between reloads.
+		for (size_t i = binding.locations.size(); i < snapshot.values.size(); ++i) {
+			auto it = program.uniforms.find(snapshot.values[i].name);
+			bool found = it != program.uniforms.end() and it->second.type == GL_FLOAT;
+
+			binding.locations.push_back(found ? it->second.location : -1);
+		}
+
+		for (size_t i = 0; i != snapshot.values.size(); ++i) {
+			if (binding.locations[i] != -1) {
+				glProgramUniform1f(program.id, binding.locations[i], snapshot.values[i].value);
+			}
+		}
+	}
+
+	// Call after `destroy_scene`.
+	inline void scene_report(const Scene& scene) {
+		std::chrono::duration<double, std::milli> worst { vizzy::clock::duration { scene.worst.load() } };
+
+		VIZZY_OKAY(
+			"scene: ticks = {}, overruns = {}, worst = {:.2f}ms, errors = {}, stale = {}/{} frames, "
+			"dropped = {} events",
+			scene.ticks.load(),
+			scene.overruns.load(),
+			worst.count(),
+			scene.errors.load(),
+			scene.stale,
+			scene.frames,
+			scene.dropped);
+
+		using ms = std::chrono::duration<double, std::milli>;
+
+		uint64_t ticks = std::max(scene.ticks.load(), uint64_t { 1 });
+
+		VIZZY_OKAY("scene gc: cycles = {}, forced = {}, total = {:.2f}ms, mean = {:.3f}ms, worst = {:.3f}ms",
+			scene.gc.cycles,
+			scene.gc.forced,
+			ms(scene.gc.time).count(),
+			ms(scene.gc.time).count() / static_cast<double>(ticks),
+			ms(scene.gc.worst).count());
+
+		VIZZY_OKAY("scene arena: allocations = {}, frees = {}, large = {}, failures = {}, peak = {:.1f}KiB",
+			scene.arena.allocations,
+			scene.arena.frees,
+			scene.arena.large,
+			scene.arena.failures,
+			static_cast<double>(scene.arena.peak) / 1024.0);
+	}
+}  // namespace vizzy
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef VIZZY_STORAGE_HPP
+#define VIZZY_STORAGE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+
+#include <glad/gl.h>
+
+#include <vizzy/util.hpp>
+#include <vizzy/gl.hpp>
+#include <vizzy/bank.hpp>
+#include <vizzy/voice.hpp>
+
+// Persistently mapped storage buffers
+namespace vizzy::gl {
+	// One region is written by the CPU while the GPU may still be reading the other two.
+	inline constexpr size_t storage_regions = 3;
+
+	struct StorageBuffer {
+		BufferHandle buffer {};
+		GLuint binding = 0;
+
+		std::byte* mapping = nullptr;
+
+		size_t size = 0;  // Usable bytes per region.
+		size_t stride = 0;  // Bytes between regions, respects GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT.
+
+		std::array<GLsync, storage_regions> fences {};
+		size_t region = 0;
+		bool writing = false;
+
+		size_t stalls = 0;  // Times a region was still in use when we wanted to write it.
+	};
+
+	[[nodiscard]] inline StorageBuffer create_storage(size_t size, GLuint binding) {
+		// INFO: https://www.khronos.org/opengl/wiki/Buffer_Object#Persistent_mapping
+
+		VIZZY_FUNCTION();
+
+		size_t alignment = static_cast<size_t>(gl_get_integer(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT));
+		size_t stride = (size + alignment - 1) / alignment * alignment;
+
+		constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		StorageBuffer storage { .binding = binding, .size = size, .stride = stride };
+
+		call(glCreateBuffers, 1, &storage.buffer.id);
+		call(glNamedBufferStorage, storage.buffer, stride * storage_regions, nullptr, flags);
+
+		storage.mapping = static_cast<std::byte*>(call(glMapNamedBufferRange, storage.buffer, 0, stride * storage_regions, flags));
+
+		if (storage.mapping == nullptr) {
+			vizzy::die("glMapNamedBufferRange failed!");
+		}
+
+		VIZZY_DEBUG("size = {}b, stride = {}b, binding = {}", size, stride, binding);
+		VIZZY_OKAY("successfully created storage buffer ({})", storage.buffer);
+
+		return storage;
+	}
+
+	inline void destroy_storage(StorageBuffer& storage) {
+		for (GLsync& fence: storage.fences) {
+			if (fence != nullptr) {
+				glDeleteSync(fence);
+				fence = nullptr;
+			}
+		}
+
+		glUnmapNamedBuffer(storage.buffer);
+
+		storage = {};
+	}
+
+	// Fences the region written last frame, moves on to the next one and returns it for writing.
+	// With three regions the fence we wait on was issued two frames ago so in practice it has
+	// already signalled and this never blocks.
+	[[nodiscard]] inline std::span<std::byte> storage_begin(StorageBuffer& storage) {
+		if (storage.writing) {
+			storage.fences[storage.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			storage.region = (storage.region + 1) % storage_regions;
+		}
+
+		storage.writing = true;
+
+		if (GLsync& fence = storage.fences[storage.region]; fence != nullptr) {
+			if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+				if (storage.stalls++ == 0) {
+					VIZZY_WARN("storage buffer ({}) region {} still in use by the GPU", storage.buffer, storage.region);
+				}
+
+				glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
+			}
+
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+
+		return { storage.mapping + storage.region * storage.stride, storage.size };
+	}
+
+	// Point the binding at the region that was just written.
+	inline void storage_bind(const StorageBuffer& storage) {
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER,
+			storage.binding,
+			storage.buffer,
+			storage.region * storage.stride,
+			storage.size);
+	}
+}  // namespace vizzy::gl
+
+// Per-frame data block
+// Everything the shaders need each frame lives in a single storage block so it can be written
+// in one pass and bound with one call.
+namespace vizzy {
+	inline constexpr GLuint frame_binding = 0;
+
+	struct FrameHeader {
+		float aspect = 0.f;
+		float t = 0.f;
+		int32_t frame = 0;
+		uint32_t envelope_count = 0;
+
+		uint32_t voice_count = 0;
+		uint32_t scene_count = 0;
+		std::array<uint32_t, 2> clock {};  // vizzy::clock ticks, low word first, see `frame_ticks`.
+	};
+
+	// Active voices are packed to the front of the array, `voice_count` of them are valid.
+	struct FrameVoice {
+		float amplitude = 0.f;
+		float velocity = 0.f;
+		uint32_t note = 0;
+		uint32_t channel = 0;
+	};
+
+	static_assert(sizeof(FrameHeader) == 32, "FrameHeader must match the std430 layout in frame_glsl");
+	static_assert(offsetof(FrameHeader, clock) == 24, "FrameHeader must match the std430 layout in frame_glsl");
+	static_assert(sizeof(FrameVoice) == 16, "FrameVoice must match the std430 layout in frame_glsl");
+
+	// GLSL has no 64-bit integers without an extension so clock ticks are passed as a uvec2.
+	[[nodiscard]] inline std::array<uint32_t, 2> frame_ticks(vizzy::timepoint time) {
+		auto ticks = static_cast<uint64_t>(time.time_since_epoch().count());
+		return { static_cast<uint32_t>(ticks), static_cast<uint32_t>(ticks >> 32) };
+	}
+
+	namespace detail {
+		// Arrays are declared with at least one element, so offsets past them have to count it too.
+		[[nodiscard]] inline size_t frame_extent(size_t count) {
+			return std::max(count, size_t { 1 });
+		}
+
+		// Byte offsets of the arrays after the header. `frame_glsl` pins the GLSL members to these
+		// so the shader side can't drift from what `frame_write` writes, std430 alone would start
+		// `voices` right after the last scalar member.
+		struct FrameLayout {
+			size_t voices = 0;
+			size_t envelopes = 0;
+			size_t scene_data = 0;
+			size_t size = 0;
+		};
+
+		[[nodiscard]] inline FrameLayout frame_layout(
+			const vizzy::EnvelopeBank& bank, const vizzy::VoicePool& pool, size_t scene_count) {
+			FrameLayout layout;
+
+			layout.voices = sizeof(FrameHeader);
+			layout.envelopes = layout.voices + frame_extent(pool.voices.size()) * sizeof(FrameVoice);
+
+			// A deferred bank has no levels to write, `envelopes` isn't declared at all.
+			layout.scene_data = layout.envelopes + (bank.deferred ? 0 : frame_extent(bank.count) * sizeof(float));
+			layout.size = layout.scene_data + frame_extent(scene_count) * sizeof(float);
+
+			return layout;
+		}
+	}  // namespace detail
+
+	[[nodiscard]] inline size_t frame_size(
+		const vizzy::EnvelopeBank& bank, const vizzy::VoicePool& pool, size_t scene_count) {
+		return detail::frame_layout(bank, pool, scene_count).size;
+	}
+
+	// GLSL declaration matching `frame_write`. Envelopes are reachable by index through
+	// `envelopes[i]` or by name through the generated defines, `scene_data` is written by the scene
+	// script. A deferred bank has no `envelopes` array, shaders go through the functions and defines
+	// from `gpu_bank_glsl` and `envelope_count` is how many of those there are.
+	[[nodiscard]] inline std::string frame_glsl(
+		const vizzy::EnvelopeBank& bank, const vizzy::VoicePool& pool, size_t scene_count) {
+		auto layout = detail::frame_layout(bank, pool, scene_count);
+
+		std::string envelopes;
+
+		if (not bank.deferred) {
+			envelopes = fmt::format(
+				"layout (offset = {}) float envelopes[{}];", layout.envelopes, detail::frame_extent(bank.count));
+		}
+
+		std::string glsl = fmt::format(R"(
+			struct VizzyVoice {{
+				float amplitude;
+				float velocity;
+				uint note;
+				uint channel;
+			}};
+
+			layout (std430, binding = {}) readonly buffer Vizzy {{
+				float aspect;
+				float t;
+				int frame;
+				uint envelope_count;
+				uint voice_count;
+				uint scene_count;
+				uvec2 clock;
+				layout (offset = {}) VizzyVoice voices[{}];
+				{}
+				layout (offset = {}) float scene_data[{}];
+			}};
+		)",
+			frame_binding,
+			layout.voices,
+			detail::frame_extent(pool.voices.size()),
+			envelopes,
+			layout.scene_data,
+			detail::frame_extent(scene_count));
+
+		if (bank.deferred) {
+			return glsl;
+		}
+
+		for (size_t i = 0; i != bank.count; ++i) {
+			glsl += fmt::format("#define {} envelopes[{}]\n", bank.names[i], i);
+		}
+
+		return glsl;
+	}
+
+	inline void frame_write(std::span<std::byte> region,
+		FrameHeader header,
+		const vizzy::EnvelopeBank& bank,
+		const vizzy::VoicePool& pool,
+		std::span<const float> scene_data) {
+		auto layout = detail::frame_layout(bank, pool, scene_data.size());
+		std::byte* out = region.data();
+
+		header.envelope_count = static_cast<uint32_t>(bank.count);
+		header.voice_count = static_cast<uint32_t>(pool.active.size());
+		header.scene_count = static_cast<uint32_t>(scene_data.size());
+
+		std::memcpy(out, &header, sizeof(FrameHeader));
+		out += sizeof(FrameHeader);
+
+		for (uint32_t index: pool.active) {
+			const vizzy::Voice& voice = pool.voices[index];
+
+			FrameVoice packed {
+				.amplitude = voice.current_amplitude,
+				.velocity = voice.velocity,
+				.note = voice.note,
+				.channel = voice.channel,
+			};
+
+			std::memcpy(out, &packed, sizeof(FrameVoice));
+			out += sizeof(FrameVoice);
+		}
+
+		if (not bank.deferred) {
+			std::memcpy(region.data() + layout.envelopes, bank.current_amplitudes.data(), bank.count * sizeof(float));
+		}
+
+		std::memcpy(region.data() + layout.scene_data, scene_data.data(), scene_data.size_bytes());
+	}
+}  // namespace vizzy
+
+#endif
@@ -1,15 +1,29 @@
 #ifndef VIZZY_UTIL_HPP
 #define VIZZY_UTIL_HPP
 
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <chrono>
 #include <stdexcept>
+#include <string_view>
+#include <vector>
 #include <type_traits>
 #include <utility>
+#include <span>
 #include <sstream>
 #include <optional>
 
 #include <vizzy/macro.hpp>
 #include <vizzy/log.hpp>
 
+// Time
+namespace vizzy {
+	using clock = std::chrono::steady_clock;
+	using timeunit = std::chrono::milliseconds;
+	using timepoint = std::chrono::time_point<clock>;
+}
+
 // Concepts
 namespace vizzy {
 	template <typename T, typename U>
@@ -36,6 +50,9 @@ namespace vizzy {
 			vizzy::log(ss, LogKind::Error, std::nullopt, std::forward<T>(arg), std::forward<Ts>(args)...);
 		}
 
+		// Anything logged before this should be printed before it.
+		vizzy::log_flush();
+
 		throw Fatal { ss.str() };
 	}
 
@@ -43,14 +60,14 @@ namespace vizzy {
 #define VIZZY_DIE(...) \
 	do { \
 		[VIZZY_VAR(func) = VIZZY_LOCATION_FUNC]<typename... Ts>(Ts&&... VIZZY_VAR(args)) { \
-			vizzy::die(vizzy::LogInfo { VIZZY_LOCATION_FILE, VIZZY_LOCATION_LINE, VIZZY_VAR(func) }, \
+			vizzy::die(VIZZY_LOG_INFO(VIZZY_VAR(func)), \
 				std::forward<Ts>(VIZZY_VAR(args))...); \
 		}(__VA_ARGS__); \
 	} while (0)
 
 #define VIZZY_UNREACHABLE() \
 	do { \
-		vizzy::die(vizzy::LogInfo { VIZZY_LOCATION_FILE, VIZZY_LOCATION_LINE, VIZZY_LOCATION_FUNC }, "unreachable!"); \
+		vizzy::die(VIZZY_LOG_INFO(VIZZY_LOCATION_FUNC), "unreachable!"); \
 	} while (0)
 
 }  // namespace vizzy
@@ -88,6 +105,37 @@ namespace vizzy {
 		return ((std::forward<T>(first) != std::forward<Ts>(rest)) and ...);
 	}
 
+	// Parse a numeric commandline argument or die trying.
+	template <typename T>
+	[[nodiscard]] inline T parse_number(std::string_view sv, std::string_view what) {
+		T value {};
+		auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), value);
+
+		if (ec != std::errc {} or ptr != sv.data() + sv.size()) {
+			die("invalid number '{}' for '{}'", sv, what);
+		}
+
+		return value;
+	}
+
+	// Nearest-rank percentile, `p` in [0, 1]. Reorders `values`.
+	template <typename T>
+	[[nodiscard]] inline T percentile(std::span<T> values, double p) {
+		if (values.empty()) {
+			return T {};
+		}
+
+		size_t rank = std::min(values.size() - 1, static_cast<size_t>(p * static_cast<double>(values.size())));
+		std::nth_element(values.begin(), values.begin() + rank, values.end());
+
+		return values[rank];
+	}
+
+	template <typename T>
+	[[nodiscard]] inline T percentile(std::vector<T>& values, double p) {
+		return percentile(std::span<T> { values }, p);
+	}
+
 	// Trim surrounding whitespace
 	inline std::string_view trim(std::string_view s) {
 		auto it = s.begin();
@@ -104,6 +152,22 @@ namespace vizzy {
 	}
 }  // namespace vizzy
 
+// Hashing
+namespace vizzy {
+	inline constexpr uint64_t fnv_offset = 0xcbf29ce484222325;
+	inline constexpr uint64_t fnv_prime = 0x100000001b3;
+
+	// FNV-1a, chain calls by passing the previous result as `hash`.
+	[[nodiscard]] constexpr uint64_t fnv1a(std::string_view sv, uint64_t hash = fnv_offset) {
+		for (char c: sv) {
+			hash ^= static_cast<uint8_t>(c);
+			hash *= fnv_prime;
+		}
+
+		return hash;
+	}
+}  // namespace vizzy
+
 // IO
 namespace vizzy {
 	inline std::string read_file(std::filesystem::path path) {
@@ -10,8 +10,28 @@
 #include <vizzy/macro.hpp>
 #include <vizzy/util.hpp>
 #include <vizzy/log.hpp>
+#include <vizzy/ring.hpp>
+#include <vizzy/midi.hpp>
+#include <vizzy/handle.hpp>
 #include <vizzy/gl.hpp>
 #include <vizzy/env.hpp>
+#include <vizzy/bank.hpp>
+#include <vizzy/voice.hpp>
+#include <vizzy/storage.hpp>
+#include <vizzy/gpubank.hpp>
+#include <vizzy/cache.hpp>
+#include <vizzy/offline.hpp>
+#include <vizzy/context.hpp>
+#include <vizzy/pacing.hpp>
+#include <vizzy/compile.hpp>
+#include <vizzy/watch.hpp>
+#include <vizzy/arena.hpp>
+#include <vizzy/scene.hpp>
+#include <vizzy/profile.hpp>
+#include <vizzy/graph.hpp>
+#include <vizzy/effects.hpp>
+#include <vizzy/latency.hpp>
+#include <vizzy/bench.hpp>
 
 // Definitions
 namespace vizzy {
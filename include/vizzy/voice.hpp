@@ -0,0 +1,284 @@
+#ifndef VIZZY_VOICE_HPP
+#define VIZZY_VOICE_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <libremidi/message.hpp>
+
+#include <vizzy/log.hpp>
+#include <vizzy/midi.hpp>
+#include <vizzy/env.hpp>
+
+// Polyphonic voices
+// A fixed pool of per-note envelopes. Everything is allocated when the pool is created, note on/off
+// only move indices between a free stack, a dense active list and a (channel, note) lookup table.
+namespace vizzy {
+	inline constexpr size_t midi_channels = 16;
+	inline constexpr size_t midi_notes = 128;
+
+	inline constexpr uint32_t voice_none = UINT32_MAX;
+
+	// What to do with a note on when every voice is in use.
+	enum class VoiceSteal {
+		Oldest,  // Reuse the voice that was started the longest time ago.
+		None,  // Ignore the new note.
+	};
+
+	struct Voice {
+		int64_t trigger = 0;  // vizzy::clock ticks of note on.
+		int64_t release = 0;  // vizzy::clock ticks of note off, max while held.
+
+		float trigger_amplitude = 0.f;
+		float release_amplitude = 0.f;
+		float current_amplitude = 0.f;
+		float velocity = 0.f;
+
+		uint8_t channel = 0;  // 1-16 like libremidi.
+		uint8_t note = 0;
+
+		uint32_t slot = voice_none;  // Position in `VoicePool::active`.
+
+		// Allocation order, oldest to newest. Used for stealing.
+		uint32_t older = voice_none;
+		uint32_t newer = voice_none;
+	};
+
+	struct VoicePool {
+		std::vector<Voice> voices;
+
+		std::vector<uint32_t> free;  // Stack of unused voices.
+		std::vector<uint32_t> active;  // Dense list of voices in use, unordered.
+
+		std::array<uint32_t, midi_channels * midi_notes> lookup;  // (channel, note) -> voice.
+
+		uint32_t oldest = voice_none;
+		uint32_t newest = voice_none;
+
+		// Shape: `segments` play from note on and the last target is held until note off, then the
+		// voice fades to zero over `release` and is returned to the pool.
+		std::vector<Segment> segments;
+		vizzy::timeunit release {};
+
+		uint16_t channels = 0xFFFF;  // Bit `n` accepts channel `n + 1`.
+		VoiceSteal steal = VoiceSteal::Oldest;
+
+		size_t stolen = 0;
+		size_t ignored = 0;
+	};
+
+	[[nodiscard]] inline VoicePool create_voice_pool(size_t capacity,
+		std::vector<Segment> segments,
+		vizzy::timeunit release,
+		uint16_t channels = 0xFFFF,
+		VoiceSteal steal = VoiceSteal::Oldest) {
+		VIZZY_FUNCTION();
+
+		VoicePool pool;
+
+		pool.voices.resize(capacity);
+		pool.free.reserve(capacity);
+		pool.active.reserve(capacity);
+		pool.lookup.fill(voice_none);
+
+		// Reverse so voice 0 is handed out first.
+		for (size_t i = capacity; i != 0; --i) {
+			pool.free.push_back(static_cast<uint32_t>(i - 1));
+		}
+
+		pool.segments = std::move(segments);
+		pool.release = release;
+		pool.channels = channels;
+		pool.steal = steal;
+
+		VIZZY_DEBUG("capacity = {}, segments = {}, release = {}", capacity, pool.segments, pool.release);
+
+		return pool;
+	}
+
+	namespace detail {
+		[[nodiscard]] inline size_t voice_key(uint8_t channel, uint8_t note) {
+			return (channel - 1) * midi_notes + note;
+		}
+
+		inline void voice_unlink(VoicePool& pool, uint32_t index) {
+			Voice& voice = pool.voices[index];
+
+			(voice.older == voice_none ? pool.oldest : pool.voices[voice.older].newer) = voice.newer;
+			(voice.newer == voice_none ? pool.newest : pool.voices[voice.newer].older) = voice.older;
+
+			voice.older = voice_none;
+			voice.newer = voice_none;
+		}
+
+		inline void voice_link_newest(VoicePool& pool, uint32_t index) {
+			Voice& voice = pool.voices[index];
+
+			voice.older = pool.newest;
+			voice.newer = voice_none;
+
+			(pool.newest == voice_none ? pool.oldest : pool.voices[pool.newest].newer) = index;
+			pool.newest = index;
+		}
+
+		inline void voice_free(VoicePool& pool, uint32_t index) {
+			Voice& voice = pool.voices[index];
+
+			// Swap-remove from the dense list.
+			uint32_t last = pool.active.back();
+			pool.active[voice.slot] = last;
+			pool.voices[last].slot = voice.slot;
+			pool.active.pop_back();
+
+			voice_unlink(pool, index);
+
+			pool.lookup[voice_key(voice.channel, voice.note)] = voice_none;
+			voice.slot = voice_none;
+
+			pool.free.push_back(index);
+		}
+
+		[[nodiscard]] inline uint32_t voice_allocate(VoicePool& pool) {
+			if (pool.free.empty()) {
+				if (pool.steal == VoiceSteal::None or pool.oldest == voice_none) {
+					pool.ignored++;
+					return voice_none;
+				}
+
+				pool.stolen++;
+				voice_free(pool, pool.oldest);
+			}
+
+			uint32_t index = pool.free.back();
+			pool.free.pop_back();
+
+			pool.voices[index].slot = static_cast<uint32_t>(pool.active.size());
+			pool.active.push_back(index);
+
+			return index;
+		}
+	}  // namespace detail
+
+	inline void voice_note_on(VoicePool& pool, uint8_t channel, uint8_t note, uint8_t velocity, vizzy::timepoint time) {
+		size_t key = detail::voice_key(channel, note);
+		uint32_t index = pool.lookup[key];
+
+		// Retrigger a note that is still sounding rather than stacking a second voice on it.
+		if (index == voice_none) {
+			index = detail::voice_allocate(pool);
+
+			if (index == voice_none) {
+				return;
+			}
+
+			pool.voices[index].current_amplitude = 0.f;
+			pool.lookup[key] = index;
+		}
+
+		else {
+			detail::voice_unlink(pool, index);
+		}
+
+		detail::voice_link_newest(pool, index);
+
+		Voice& voice = pool.voices[index];
+
+		voice.trigger = time.time_since_epoch().count();
+		voice.release = vizzy::timepoint::max().time_since_epoch().count();
+		voice.trigger_amplitude = voice.current_amplitude;
+		voice.velocity = static_cast<float>(velocity) / 127.f;
+		voice.channel = channel;
+		voice.note = note;
+	}
+
+	inline void voice_note_off(VoicePool& pool, uint8_t channel, uint8_t note, vizzy::timepoint time) {
+		uint32_t index = pool.lookup[detail::voice_key(channel, note)];
+
+		if (index == voice_none) {
+			return;
+		}
+
+		Voice& voice = pool.voices[index];
+
+		voice.release = time.time_since_epoch().count();
+		voice.release_amplitude = voice.current_amplitude;
+	}
+
+	// Routes NOTE_ON/NOTE_OFF, anything else is ignored.
+	inline void voice_event(VoicePool& pool, const vizzy::MidiEvent& ev, vizzy::timepoint time) {
+		int channel = ev.get_channel();
+
+		if (channel == 0 or not(pool.channels & (1u << (channel - 1)))) {
+			return;
+		}
+
+		auto type = ev.get_message_type();
+		uint8_t note = ev.data1 & 0x7F;
+
+		// NOTE_ON with zero velocity is a note off by convention.
+		if (type == libremidi::message_type::NOTE_ON and ev.data2 != 0) {
+			voice_note_on(pool, static_cast<uint8_t>(channel), note, ev.data2, time);
+		}
+
+		else if (type == libremidi::message_type::NOTE_OFF or type == libremidi::message_type::NOTE_ON) {
+			voice_note_off(pool, static_cast<uint8_t>(channel), note, time);
+		}
+	}
+
+	// Evaluates every active voice and returns finished ones to the pool. Cost is linear in the
+	// number of sounding voices, not the capacity of the pool.
+	inline void voice_update(VoicePool& pool, vizzy::timepoint current_time) {
+		using ms = std::chrono::duration<float, std::milli>;
+
+		int64_t now = current_time.time_since_epoch().count();
+		float release = ms(pool.release).count();
+
+		// Iterate backwards so swap-removal doesn't skip anything.
+		for (size_t i = pool.active.size(); i != 0; --i) {
+			uint32_t index = pool.active[i - 1];
+			Voice& voice = pool.voices[index];
+
+			if (now >= voice.release) {
+				float t = ms(vizzy::clock::duration(now - voice.release)).count();
+
+				if (t >= release) {
+					voice.current_amplitude = 0.f;
+					detail::voice_free(pool, index);
+					continue;
+				}
+
+				voice.current_amplitude = linear(voice.release_amplitude, 0.f, t / release);
+				continue;
+			}
+
+			auto relative = vizzy::clock::duration(now - voice.trigger);
+
+			if (pool.segments.empty()) {
+				voice.current_amplitude = 1.f;
+				continue;
+			}
+
+			// Hold the final target once every segment has played.
+			float amp = relative.count() < 0 ? voice.trigger_amplitude : pool.segments.back().end_amp;
+
+			for (size_t s = 0; s != pool.segments.size(); ++s) {
+				auto [start_time, end_time, start_amp, end_amp] = pool.segments[s];
+
+				if (relative < start_time or relative >= end_time) {
+					continue;
+				}
+
+				float x = ms(relative - start_time).count() / ms(end_time - start_time).count();
+				amp = linear(s == 0 ? voice.trigger_amplitude : start_amp, end_amp, x);
+
+				break;
+			}
+
+			voice.current_amplitude = amp;
+		}
+	}
+}  // namespace vizzy
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef VIZZY_WATCH_HPP
+#define VIZZY_WATCH_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <vizzy/util.hpp>
+#include <vizzy/log.hpp>
+#include <vizzy/ring.hpp>
+
+// File watching
+// INFO: https://man7.org/linux/man-pages/man7/inotify.7.html
+// Parent directories are watched rather than the files themselves because most editors save by
+// writing a temporary and renaming it over the original, which would silently drop a watch on the
+// old inode. Saves tend to arrive as bursts of events so a file is only reported once it has been
+// quiet for the debounce period.
+namespace vizzy {
+	inline constexpr auto watch_debounce = std::chrono::milliseconds { 50 };
+
+	struct WatchEvent {
+		uint32_t file;  // Index into `Watcher::files`.
+		vizzy::timepoint changed;  // First change in the burst.
+	};
+
+	struct Watcher {
+		std::vector<std::filesystem::path> files;
+
+		int fd = -1;
+		std::vector<int> descriptors;  // Watch descriptor per entry in `files`, shared between files in one directory.
+
+		std::thread thread;
+		std::atomic<bool> stop = false;
+
+		Ring<WatchEvent, 64> ring;  // Watcher thread to render thread.
+
+		// Joins the thread if `destroy_watcher` wasn't reached, e.g. when `vizzy::die` unwinds past it.
+		~Watcher();
+	};
+
+	namespace detail {
+		inline void watch_thread(Watcher& watcher) {
+			struct Change {
+				std::optional<vizzy::timepoint> first;
+				vizzy::timepoint last;
+			};
+
+			std::vector<Change> changes(watcher.files.size());
+
+			// Large enough for a burst of events with full length names.
+			alignas(inotify_event) char buffer[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+
+			while (not watcher.stop.load(std::memory_order_relaxed)) {
+				pollfd pfd { watcher.fd, POLLIN, 0 };
+				int ready = ::poll(&pfd, 1, static_cast<int>(watch_debounce.count()));
+
+				auto now = vizzy::clock::now();
+
+				if (ready > 0) {
+					ssize_t length = ::read(watcher.fd, buffer, sizeof(buffer));
+
+					for (ssize_t offset = 0; offset < length;) {
+						const auto* ev = reinterpret_cast<const inotify_event*>(buffer + offset);
+						offset += static_cast<ssize_t>(sizeof(inotify_event) + ev->len);
+
+						if (ev->len == 0) {
+							continue;
+						}
+
+						for (size_t i = 0; i != watcher.files.size(); ++i) {
+							if (watcher.descriptors[i] != ev->wd or watcher.files[i].filename() != ev->name) {
+								continue;
+							}
+
+							if (not changes[i].first) {
+								changes[i].first = now;
+							}
+
+							changes[i].last = now;
+						}
+					}
+				}
+
+				for (size_t i = 0; i != changes.size(); ++i) {
+					if (not changes[i].first or now - changes[i].last < watch_debounce) {
+						continue;
+					}
+
+					if (not ring_push(watcher.ring, WatchEvent { static_cast<uint32_t>(i), *changes[i].first })) {
+						VIZZY_WARN("dropped change to '{}'", watcher.files[i].string());
+					}
+
+					changes[i].first.reset();
+				}
+			}
+		}
+	}  // namespace detail
+
+	// Non-movable because the thread holds a reference, so it's set up in place.
+	inline void create_watcher(Watcher& watcher, std::vector<std::filesystem::path> files) {
+		VIZZY_FUNCTION();
+
+		watcher.fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+		if (watcher.fd == -1) {
+			vizzy::die("inotify_init1 failed: {}", std::strerror(errno));
+		}
+
+		for (auto& file: files) {
+			file = std::filesystem::absolute(file).lexically_normal();
+
+			auto directory = file.parent_path();
+			int wd = ::inotify_add_watch(watcher.fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+
+			if (wd == -1) {
+				vizzy::die("cannot watch '{}': {}", directory.string(), std::strerror(errno));
+			}
+
+			watcher.descriptors.push_back(wd);
+
+			VIZZY_DEBUG("watching '{}'", file.string());
+		}
+
+		watcher.files = std::move(files);
+		watcher.thread = std::thread(detail::watch_thread, std::ref(watcher));
+	}
+
+	inline void destroy_watcher(Watcher& watcher) {
+		watcher.stop = true;
+
+		if (watcher.thread.joinable()) {
+			watcher.thread.join();
+		}
+
+		if (watcher.fd != -1) {
+			::close(watcher.fd);
+			watcher.fd = -1;
+		}
+	}
+
+	inline Watcher::~Watcher() {
+		destroy_watcher(*this);
+	}
+
+	// Calls `fn` with every debounced change since the last drain.
+	template <typename F>
+	inline size_t watch_drain(Watcher& watcher, F&& fn) {
+		return ring_drain(watcher.ring, std::forward<F>(fn));
+	}
+}  // namespace vizzy
+
+#endif
@@ -1 +1,23 @@
 print("hello world")
+
+local notes = 0
+
+function on_load()
+	vizzy.set("notes", 0)
+end
+
+function on_event(type, channel, note, velocity)
+	if type == "note_on" and velocity > 0 then
+		notes = notes + 1
+		vizzy.set("notes", notes)
+	end
+
+	-- Held velocity per note, read in shaders as scene_data[note].
+	if type == "note_on" or type == "note_off" then
+		vizzy.data:set(note + 1, type == "note_on" and velocity / 127 or 0)
+	end
+end
+
+function on_update(t, dt)
+	vizzy.set("pulse", vizzy.envelope("keyboard") * (0.5 + 0.5 * math.sin(t * 4)))
+end
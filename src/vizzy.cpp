@@ -1,8 +1,9 @@
 #include <iostream>
 #include <chrono>
+#include <cmath>
+#include <optional>
 #include <string_view>
 #include <vector>
-#include <mutex>
 
 #include <conflict/conflict.hpp>
 
@@ -23,6 +24,10 @@
 // Commandline flags
 enum : uint64_t {
 	OPT_HELP = 1 << 0,
+	OPT_SKEW = 1 << 1,
+	OPT_HEADLESS = 1 << 2,
+	OPT_NO_CACHE = 1 << 3,
+	OPT_GPU_ENVELOPES = 1 << 4,
 };
 
 int main(int argc, const char* argv[]) {
@@ -32,10 +37,44 @@ int main(int argc, const char* argv[]) {
 		// Parse arguments
 		uint64_t flags;
 		std::string_view filename;
+		std::string_view bench;
+		std::string_view lookahead;
+		std::string_view render;
+		std::string_view fps;
+		std::string_view output;
+		std::string_view frames;
+		std::string_view trace;
+		std::string_view latency;
+		std::string_view cache;
+		std::string_view vert_file;
+		std::string_view frag_file;
+		std::string_view decay;
+		std::string_view effects;
+		std::string_view log_level;
+		std::string_view vsync;
 
 		auto parser = conflict::parser {
 			conflict::option { { 'h', "help", "show help" }, flags, OPT_HELP },
-			conflict::string_option { { 'f', "file", "input file" }, "filename", filename },
+			conflict::string_option { { 'f', "file", "Lua scene script, reloaded when it changes" }, "file.lua", filename },
+			conflict::string_option { { 'b', "bench", "run a benchmark and exit (envelopes, effects, lua)" }, "name", bench },
+			conflict::string_option { { 'l', "lookahead", "schedule MIDI triggers this many ms ahead" }, "ms", lookahead },
+			conflict::option { { 's', "skew", "report trigger-to-render skew on exit" }, flags, OPT_SKEW },
+			conflict::string_option { { 'r', "render", "render a MIDI file offline instead of listening to a port" }, "file.mid", render },
+			conflict::string_option { { 'F', "fps", "frames per second when rendering (default 60)" }, "fps", fps },
+			conflict::string_option { { 'o', "output", "directory to write rendered frames to (default frames)" }, "dir", output },
+			conflict::option { { 'H', "headless", "render offscreen through EGL without a window" }, flags, OPT_HEADLESS },
+			conflict::string_option { { 'n', "frames", "exit after this many frames" }, "count", frames },
+			conflict::string_option { { 't', "trace", "write a Chrome/Perfetto trace of every frame on exit" }, "file.json", trace },
+			conflict::string_option { { 'L', "latency", "inject this many notes, report MIDI-to-swap latency and exit" }, "count", latency },
+			conflict::string_option { { 'c', "cache", "program binary cache directory (default ~/.cache/vizzy)" }, "dir", cache },
+			conflict::option { { 'C', "no-cache", "always compile shaders" }, flags, OPT_NO_CACHE },
+			conflict::option { { 'G', "gpu-envelopes", "evaluate envelopes in shaders instead of on the CPU every frame" }, flags, OPT_GPU_ENVELOPES },
+			conflict::string_option { { 'v', "vert", "vertex shader, reloaded when it changes" }, "file.glsl", vert_file },
+			conflict::string_option { { 'g', "frag", "fragment shader, reloaded when it changes" }, "file.glsl", frag_file },
+			conflict::string_option { { 'd', "decay", "keep a fading trail of previous frames (0-1, default off)" }, "amount", decay },
+			conflict::string_option { { 'e', "effects", "compute effects to apply in order (blur,feedback,grade,bloom)" }, "list", effects },
+			conflict::string_option { { 'S', "vsync", "vsync mode (on, adaptive, off), frames are paced to vblank unless off" }, "mode", vsync },
+			conflict::string_option { { 'V', "log-level", "hide log messages below this level (debug, info, warn, error)" }, "level", log_level },
 		};
 
 		parser.apply_defaults();
@@ -63,103 +102,233 @@ int main(int argc, const char* argv[]) {
 			return EXIT_SUCCESS;
 		}
 
+		if (not log_level.empty()) {
+			auto level = vizzy::log_level_from_str(log_level);
+
+			if (not level) {
+				vizzy::die("unknown log level '{}'", log_level);
+			}
+
+			vizzy::log_set_level(*level);
+		}
+
+		// Logging goes through a writer thread from here on.
+		vizzy::log_start();
+
+		if (bench == "envelopes") {
+			vizzy::bench_envelopes();
+			return EXIT_SUCCESS;
+		}
+
+		else if (bench == "effects") {
+			vizzy::bench_effects({
+				.title = VIZZY_EXE,
+				.width = VIZZY_WINDOW_WIDTH,
+				.height = VIZZY_WINDOW_HEIGHT,
+				.gl_major = VIZZY_OPENGL_VERSION_MAJOR,
+				.gl_minor = VIZZY_OPENGL_VERSION_MINOR,
+				.debug = vizzy::gl::check_debug_context,
+			});
+
+			return EXIT_SUCCESS;
+		}
+
+		else if (bench == "lua") {
+			vizzy::bench_lua();
+			return EXIT_SUCCESS;
+		}
+
+		else if (not bench.empty()) {
+			vizzy::die("unknown benchmark '{}'", bench);
+		}
+
 		if (filename.empty()) {
-			vizzy::die("no file specified");
+			vizzy::die("no scene specified");
+		}
+
+		if (not trace.empty()) {
+			vizzy::profile_enable();
 		}
 
-		// Lua
-		// sol::state lua;
-		// lua.open_libraries(sol::lib::base, sol::lib::coroutine, sol::lib::string, sol::lib::io);
+		// Offline rendering
+		// Frames are spaced exactly 1/fps apart on a virtual clock and events fire at their position in
+		// the file, so the output is the same no matter how long each frame takes to draw.
+		bool offline = not render.empty();
+
+		vizzy::Timeline timeline;
+		double render_fps = 60.0;
+
+		if (offline) {
+			timeline = vizzy::read_timeline(render);
 
-		// std::string script = vizzy::read_file(filename);
-		// lua.script(script);
+			if (not fps.empty()) {
+				render_fps = vizzy::parse_number<double>(fps, "fps");
+			}
+
+			if (render_fps <= 0.0) {
+				vizzy::die("fps must be positive");
+			}
+		}
 
 		// Envelopes
 		using namespace std::chrono_literals;
 
-		std::mutex envelope_mutex;
-
 		std::vector envelopes = {
 			vizzy::Envelope {
 				.name = "keyboard",
-				.pattern =
-					[](libremidi::message msg) {
-						return msg.get_message_type() == libremidi::message_type::NOTE_ON and msg.get_channel() == 1;
+				.match =
+					vizzy::MidiMatch {
+						.type = libremidi::message_type::NOTE_ON,
+						.channels = vizzy::midi_channel(1),
 					},
+				.pattern = {},
 				.segments = vizzy::attack_release(50ms, 200ms),
 			},
 		};
 
 		VIZZY_DEBUG(envelopes);
 
+		vizzy::EnvelopeBank bank;
+
+		for (const auto& env: envelopes) {
+			vizzy::bank_add(bank, env);
+		}
+
+		vizzy::bank_finalize(bank);
+
+		// Scene
+		// The script gets its own thread once the loop starts, until then it's only been read.
+		vizzy::Scene scene;
+		vizzy::create_scene(scene, filename, bank);
+
+		// One voice per held note, allocated up front so note on/off never touches the heap.
+		auto voices = vizzy::create_voice_pool(64,
+			vizzy::to_segments({
+				{ .duration = 30ms, .target = 1.f },
+				{ .duration = 150ms, .target = .6f },
+			}),
+			300ms);
+
 		// MIDI
+		// The callback runs on libremidi's thread and only copies the message into a lock-free queue,
+		// triggering happens on the render thread when the queue is drained at the start of each frame.
 		libremidi::observer obs;
+		vizzy::MidiQueue midi_queue;
+
+		vizzy::MidiClock midi_clock;
+		vizzy::SkewStats skew;
+
+		if (not lookahead.empty()) {
+			std::chrono::duration<float, std::milli> ms { vizzy::parse_number<float>(lookahead, "lookahead") };
+			midi_clock.lookahead = std::chrono::duration_cast<vizzy::clock::duration>(ms);
+		}
 
 		auto midi_callback = [&](const libremidi::message& msg) {
 			VIZZY_DEBUG("channel = {}, message = {}", msg.get_channel(), msg);
+			vizzy::midi_push(midi_queue, msg, 0);
+		};
 
-			std::unique_lock lock { envelope_mutex };
-
-			for (auto& env: envelopes) {
-				env = vizzy::env_trigger(std::move(env), msg);
-			}
+		libremidi::input_configuration midi_config {
+			.on_message = midi_callback,
+			.timestamps = libremidi::timestamp_mode::SystemMonotonic,
 		};
+		std::optional<libremidi::midi_in> midi;
 
-		libremidi::input_configuration midi_config { .on_message = midi_callback };
-		libremidi::midi_in midi { midi_config };
+		vizzy::LatencyStats latency_stats;
+		vizzy::LatencyInjector latency_injector;
 
-		if (auto port = libremidi::midi1::in_default_port(); port.has_value()) {
-			midi.open_port(port.value());
+		size_t latency_count = latency.empty() ? 0 : vizzy::parse_number<size_t>(latency, "latency");
+
+		if (offline) {
+			VIZZY_DEBUG("rendering '{}', not opening a MIDI port", render);
+		}
+
+		// The injector is the only producer allowed on the queue.
+		else if (latency_count != 0) {
+			VIZZY_DEBUG("injecting {} notes, not opening a MIDI port", latency_count);
+		}
+
+		else if (auto port = libremidi::midi1::in_default_port(); port.has_value()) {
+			midi.emplace(midi_config);
+			midi->open_port(port.value());
+		}
+
+		// Headless runs are mostly CI and benchmarks where there's nothing plugged in.
+		else if (flags & OPT_HEADLESS) {
+			VIZZY_WARN("no ports available, running without MIDI input");
 		}
 
 		else {
 			vizzy::die("no ports available");
 		}
 
-		// Setup window
-		if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
-			vizzy::die("SDL_Init failed!");
-		}
+		size_t max_frames = frames.empty() ? 0 : vizzy::parse_number<size_t>(frames, "frames");
 
-		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, VIZZY_OPENGL_VERSION_MAJOR);
-		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, VIZZY_OPENGL_VERSION_MINOR);
+		vizzy::Vsync vsync_mode = vizzy::Vsync::On;
 
-		SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-		SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
-		SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 1);
+		if (not vsync.empty()) {
+			auto mode = vizzy::vsync_from_str(vsync);
 
-		SDL_Window* window = SDL_CreateWindow(VIZZY_EXE,
-			SDL_WINDOWPOS_UNDEFINED,
-			SDL_WINDOWPOS_UNDEFINED,
-			VIZZY_WINDOW_WIDTH,
-			VIZZY_WINDOW_HEIGHT,
-			SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+			if (not mode) {
+				vizzy::die("unknown vsync mode '{}'", vsync);
+			}
 
-		if (window == nullptr) {
-			vizzy::die("SDL_CreateWindow failed! SDL: {}", SDL_GetError());
+			vsync_mode = *mode;
 		}
 
-		// Setup OpenGL
-		SDL_GLContext gl = SDL_GL_CreateContext(window);
+		float feedback_decay = decay.empty() ? 0.f : vizzy::parse_number<float>(decay, "decay");
 
-		if (int v = gladLoadGL((GLADloadfunc)SDL_GL_GetProcAddress); v != 0) {
-			VIZZY_OKAY("OpenGL {}.{}", GLAD_VERSION_MAJOR(v), GLAD_VERSION_MINOR(v));
+		if (feedback_decay < 0.f or feedback_decay >= 1.f) {
+			vizzy::die("decay must be in [0, 1)");
 		}
 
-		else {
-			vizzy::die("gladLoadGLLoader failed!");
-		}
+		// Setup context
+		vizzy::ContextConfig context_config {
+			.title = VIZZY_EXE,
+			.width = VIZZY_WINDOW_WIDTH,
+			.height = VIZZY_WINDOW_HEIGHT,
+			.gl_major = VIZZY_OPENGL_VERSION_MAJOR,
+			.gl_minor = VIZZY_OPENGL_VERSION_MINOR,
+			.debug = vizzy::gl::check_debug_context,
+		};
+
+		auto context = (flags & OPT_HEADLESS) ? vizzy::create_headless_context(context_config) :
+												vizzy::create_window_context(context_config);
 
 		// Callbacks
 		vizzy::gl::setup_debug_callbacks();
 
+		// Offline frames go as fast as the GPU allows.
+		vsync_mode = vizzy::context_vsync(context, offline ? vizzy::Vsync::Off : vsync_mode);
+
+		auto pacer = vizzy::create_frame_pacer(context, vsync_mode);
+
+		// Envelopes
+		// On the GPU only triggers are uploaded, which leaves the scene without levels to read.
+		bool gpu_envelopes = (flags & OPT_GPU_ENVELOPES) != 0;
+		vizzy::GpuBank gpu_bank;
+
+		if (gpu_envelopes) {
+			gpu_bank = vizzy::create_gpu_bank(bank);
+			VIZZY_WARN("envelopes are evaluated on the GPU, scene scripts will read them as 0");
+		}
+
 		// Setup shaders
-		auto vert = vizzy::gl::create_shader(GL_VERTEX_SHADER, { R"(
-			#version 460 core
+		// Built-ins and envelopes are declared by the generated frame block.
+		std::string frame_block = vizzy::frame_glsl(bank, voices, vizzy::scene_data_size);
+
+		if (gpu_envelopes) {
+			frame_block += vizzy::gpu_bank_glsl(bank);
+		}
 
-			uniform float aspect;
-			uniform int frame;
-			out vec3 position;
+		// Stages are linked separately, so the interface between them is matched by location and
+		// the vertex outputs are redeclared.
+		std::string_view vert = R"(
+			out gl_PerVertex {
+				vec4 gl_Position;
+			};
+
+			layout (location = 0) out vec3 position;
 
 			layout (location = 0) in vec3 coord;
 
@@ -167,19 +336,11 @@ int main(int argc, const char* argv[]) {
 				gl_Position = vec4(coord.x, coord.y, coord.z, 1.0);
 				position = vec3(coord.x / aspect, coord.y, coord.z);
 			}
-		)" });
-
-		auto frag = vizzy::gl::create_shader(GL_FRAGMENT_SHADER, { R"(
-			#version 460 core
-
-			uniform float aspect;
-			uniform float t;
-			uniform int frame;
-
-			uniform float keyboard;
+		)";
 
+		std::string_view frag = R"(
 			out vec4 colour;
-			in vec3 position;
+			layout (location = 0) in vec3 position;
 
 			float circle(vec2 p, float r, float blur) {
 				float d = length(p);
@@ -195,17 +356,81 @@ int main(int argc, const char* argv[]) {
 				float c = circle(vec2(cx, cy), 0.3 + (keyboard * 0.5), .01 + (keyboard * 0.3));
 
 				vec3 cc = vec3(position.xyz + .5 + vec3(cos(cx), sin(cy), 0.0)) * c;
+
+				// A ring per held note, placed along the x axis by pitch.
+				for (uint i = 0; i < voice_count; ++i) {
+					float x = (float(voices[i].note) / 127.0) * 2.0 - 1.0;
+					float r = circle(vec2(position.x - x / aspect, position.y), 0.05 + voices[i].velocity * 0.1, 0.02);
+
+					cc += vec3(0.4, 0.6, 1.0) * r * voices[i].amplitude;
+				}
 			
 			    colour = vec4(cc.xyz, 1.0);
 			}
-		)" });
+		)";
+
+		std::filesystem::path cache_directory = cache.empty() ? vizzy::gl::default_program_cache_directory() : cache;
+
+		if (flags & OPT_NO_CACHE) {
+			cache_directory.clear();
+		}
+
+		auto program_cache = vizzy::gl::create_program_cache(cache_directory);
+
+		vizzy::gl::ShaderCompiler compiler;
+		vizzy::gl::create_shader_compiler(compiler, context);
+
+		// Frames are drawn without a pipeline until both stages are ready, after that each stage is
+		// swapped in between frames whenever its file changes.
+		std::array stages = {
+			vizzy::gl::create_pipeline_stage(GL_VERTEX_SHADER,
+				vert_file,
+				vert_file.empty() ? std::string { vert } : vizzy::read_file(vert_file)),
+			vizzy::gl::create_pipeline_stage(GL_FRAGMENT_SHADER,
+				frag_file,
+				frag_file.empty() ? std::string { frag } : vizzy::read_file(frag_file)),
+		};
+
+		std::vector<std::string_view> stage_prefix = { VIZZY_GLSL_VERSION, frame_block };
+
+		vizzy::gl::PipelineHandle pipeline;
+
+		// Where each stage's program takes the scene's values, parallel to `stages`.
+		std::array<vizzy::SceneBinding, stages.size()> scene_bindings;
+
+		for (auto& stage: stages) {
+			vizzy::gl::stage_build(compiler, program_cache, stage, stage_prefix);
+		}
+
+		// Rendered output must never contain frames from before the pipeline was ready.
+		if (offline) {
+			for (auto& stage: stages) {
+				vizzy::gl::compile_wait(program_cache, stage.pending, stage.program);
+			}
+		}
+
+		// Hot reload
+		// Only files given on the command line are watched, built-in sources never change.
+		vizzy::Watcher watcher;
+		std::vector<std::optional<size_t>> watched;  // Stage per watched file, empty for the scene.
+
+		if (not offline) {
+			std::vector<std::filesystem::path> files = { scene.path };
+			watched.push_back(std::nullopt);
+
+			for (size_t i = 0; i != stages.size(); ++i) {
+				if (not stages[i].path.empty()) {
+					files.push_back(stages[i].path);
+					watched.push_back(i);
+				}
+			}
 
-		auto program = vizzy::gl::create_program({ vert, frag });
+			vizzy::create_watcher(watcher, files);
+		}
 
-		// auto pipeline = create_pipeline({
-		// 	vert,
-		// 	frag,
-		// });
+		// Per-frame data
+		auto storage = vizzy::gl::create_storage(
+			vizzy::frame_size(bank, voices, vizzy::scene_data_size), vizzy::frame_binding);
 
 		std::array verts = {
 			glm::vec3 { -1.f, 1.f, 0.f },
@@ -217,13 +442,13 @@ int main(int argc, const char* argv[]) {
 			glm::vec3 { 1.f, -1.f, 0.f },
 		};
 
-		GLuint vao;
-		GLuint vbo;
+		vizzy::gl::VertexArrayHandle vao;
+		vizzy::gl::BufferHandle vbo;
 
-		glGenVertexArrays(1, &vao);
+		glGenVertexArrays(1, &vao.id);
 		glBindVertexArray(vao);
 
-		glGenBuffers(1, &vbo);
+		glGenBuffers(1, &vbo.id);
 		glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
@@ -232,17 +457,162 @@ int main(int argc, const char* argv[]) {
 		glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(decltype(verts)::value_type), verts.data(), GL_STATIC_DRAW);
 		glBindVertexArray(0);
 
+		auto gpu_profiler = vizzy::gl::create_gpu_profiler();
+
+		// Render graph
+		// The scene goes straight to the output unless there's post-processing: a feedback trail blended
+		// over the decayed previous frame and/or a chain of compute effects, followed by a present pass.
+		std::string_view feedback_frag = R"(
+			layout (binding = 0) uniform sampler2D scene;
+			layout (binding = 1) uniform sampler2D history;
+
+			uniform float decay;
+
+			out vec4 colour;
+
+			void main() {
+				ivec2 p = ivec2(gl_FragCoord.xy);
+				colour = max(texelFetch(scene, p, 0), texelFetch(history, p, 0) * decay);
+			}
+		)";
+
+		std::string_view present_frag = R"(
+			layout (binding = 0) uniform sampler2D source;
+
+			out vec4 colour;
+
+			void main() {
+				colour = texelFetch(source, ivec2(gl_FragCoord.xy), 0);
+			}
+		)";
+
+		vizzy::gl::RenderGraph graph;
+		vizzy::gl::Program feedback_program;
+		vizzy::gl::Program present_program;
+
+		auto draw_scene = [&](const vizzy::gl::RenderGraph&, const vizzy::gl::GraphPass&) {
+			glClearColor(.0f, .0f, .0f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT);
+
+			if (pipeline == 0) {
+				return;
+			}
+
+			glUseProgram(0);
+			glBindProgramPipeline(pipeline);
+
+			// Draw quad
+			glBindVertexArray(vao);
+			glDrawArrays(GL_TRIANGLES, 0, verts.size());
+			glBindVertexArray(0);
+		};
+
+		auto draw_fullscreen = [&](const vizzy::gl::Program& program) {
+			glUseProgram(program.id);
+
+			glBindVertexArray(vao);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+			glBindVertexArray(0);
+		};
+
+		std::vector<std::string_view> effect_names;
+
+		for (auto rest = effects; not rest.empty();) {
+			auto comma = std::min(rest.find(','), rest.size());
+
+			if (auto name = vizzy::trim(rest.substr(0, comma)); not name.empty()) {
+				effect_names.push_back(name);
+			}
+
+			rest.remove_prefix(std::min(comma + 1, rest.size()));
+		}
+
+		vizzy::gl::EffectChain effect_chain;
+
+		auto screen = vizzy::gl::graph_output(graph);
+
+		if (feedback_decay == 0.f and effect_names.empty()) {
+			vizzy::gl::graph_pass(graph, "scene", {}, { screen }, draw_scene);
+		}
+
+		else {
+			auto source = vizzy::gl::graph_texture(graph, "scene", { .format = vizzy::gl::effect_format });
+			vizzy::gl::graph_pass(graph, "scene", {}, { source }, draw_scene);
+
+			if (feedback_decay != 0.f) {
+				feedback_program = vizzy::gl::cached_program(program_cache,
+					{
+						{ GL_VERTEX_SHADER, { VIZZY_GLSL_VERSION, vizzy::gl::fullscreen_vert } },
+						{ GL_FRAGMENT_SHADER, { VIZZY_GLSL_VERSION, feedback_frag } },
+					});
+
+				glProgramUniform1f(feedback_program.id, feedback_program.uniforms.at("decay").location, feedback_decay);
+
+				auto trail = vizzy::gl::graph_history(graph, "trail", { .format = vizzy::gl::effect_format });
+
+				vizzy::gl::graph_pass(graph, "feedback", { source, trail }, { trail }, [&](const auto&, const auto&) {
+					draw_fullscreen(feedback_program);
+				});
+
+				source = trail;
+			}
+
+			if (not effect_names.empty()) {
+				int w, h;
+				vizzy::context_size(context, w, h);
+
+				effect_chain = vizzy::gl::create_effect_chain(program_cache, effect_names, w, h);
+
+				auto result = vizzy::gl::graph_texture(graph, "effects", { .format = vizzy::gl::effect_format });
+
+				// Images are stored to directly, the pass's framebuffer goes unused.
+				vizzy::gl::graph_pass(graph, "effects", { source }, { result }, [&](const auto&, const auto& pass) {
+					vizzy::gl::effect_chain_resize(effect_chain, pass.width, pass.height);
+					vizzy::gl::effect_chain_run(effect_chain,
+						vizzy::gl::graph_input(graph, pass, 0),
+						vizzy::gl::graph_target(graph, pass, 0),
+						GL_TEXTURE_FETCH_BARRIER_BIT);
+				});
+
+				source = result;
+			}
+
+			present_program = vizzy::gl::cached_program(program_cache,
+				{
+					{ GL_VERTEX_SHADER, { VIZZY_GLSL_VERSION, vizzy::gl::fullscreen_vert } },
+					{ GL_FRAGMENT_SHADER, { VIZZY_GLSL_VERSION, present_frag } },
+				});
+
+			vizzy::gl::graph_pass(graph, "present", { source }, { screen }, [&](const auto&, const auto&) {
+				draw_fullscreen(present_program);
+			});
+		}
+
+		// Start late so shader compilation doesn't count.
+		if (latency_count != 0 and not offline) {
+			vizzy::latency_inject(latency_injector, latency_count, midi_callback);
+		}
+
 		// Event loop
 		VIZZY_OKAY("loop");
 
-		SDL_Event ev;
 		bool running = true;
 
 		auto loop_start = vizzy::clock::now();
 
 		size_t frame_count = 0;
 
-		while (running) {
+		if (not offline) {
+			vizzy::scene_start(scene);
+		}
+
+		auto poll_events = [&] {
+			if (context.kind == vizzy::ContextKind::Headless) {
+				return;
+			}
+
+			SDL_Event ev;
+
 			while (SDL_PollEvent(&ev)) {
 				switch (ev.type) {
 					case SDL_QUIT: {
@@ -254,9 +624,7 @@ int main(int argc, const char* argv[]) {
 							case SDL_WINDOWEVENT_RESIZED:
 							case SDL_WINDOWEVENT_SIZE_CHANGED: {
 								int w, h;
-								SDL_GL_GetDrawableSize(window, &w, &h);
-
-								glViewport(0, 0, w, h);
+								vizzy::context_size(context, w, h);
 
 								VIZZY_DEBUG("resize event: width = {}, height = {}", w, h);
 							} break;
@@ -278,61 +646,334 @@ int main(int argc, const char* argv[]) {
 					default: break;
 				}
 			}
+		};
 
-			glClearColor(.0f, .0f, .0f, 1.0f);
-			glClear(GL_COLOR_BUFFER_BIT);
+		// Everything after triggering, shared by the realtime and offline loops.
+		auto draw_frame = [&](vizzy::timepoint current_time, GLuint framebuffer, int w, int h) {
+			for (size_t i = 0; i != stages.size(); ++i) {
+				auto& stage = stages[i];
 
-			glUseProgram(program);
+				if (not vizzy::gl::stage_swap(program_cache, stage, pipeline)) {
+					continue;
+				}
+
+				vizzy::scene_unbind(scene_bindings[i]);
 
-			auto current_time = vizzy::clock::now();
+				// The first build of each stage isn't a reload.
+				if (pipeline == 0 or stage.path.empty()) {
+					continue;
+				}
+
+				std::chrono::duration<double, std::milli> elapsed = vizzy::clock::now() - stage.changed;
+				VIZZY_OKAY("reloaded '{}' in {:.2f}ms since it changed", stage.path.string(), elapsed.count());
+			}
+
+			if (pipeline == 0 and stages[0].program.id != 0 and stages[1].program.id != 0) {
+				pipeline = vizzy::gl::create_pipeline({
+					{ stages[0].bit, stages[0].program.id },
+					{ stages[1].bit, stages[1].program.id },
+				});
+			}
 
 			{
-				std::unique_lock lock { envelope_mutex };
+				VIZZY_ZONE("envelope update");
 
-				for (auto& env: envelopes) {
-					env = vizzy::env_update(std::move(env), current_time);
+				if (gpu_envelopes) {
+					vizzy::gpu_bank_upload(gpu_bank, bank);
 				}
 
-				for (auto& env: envelopes) {
-					env = vizzy::env_bind(std::move(env), { program });
+				else {
+					vizzy::bank_update(bank, current_time);
 				}
+
+				vizzy::voice_update(voices, current_time);
 			}
 
-			int w, h;
-			SDL_GL_GetDrawableSize(window, &w, &h);
+			if (not gpu_envelopes) {
+				vizzy::scene_envelopes(scene, bank);
+			}
+
+			// Offline frames tick the scene themselves so it follows the virtual clock.
+			if (offline) {
+				VIZZY_ZONE("scene");
+				vizzy::scene_tick(scene, current_time);
+			}
 
-			float aspect = static_cast<float>(h) / static_cast<float>(w);
-			glUniform1f(glGetUniformLocation(program, "aspect"), aspect);
+			vizzy::scene_frame(scene);
 
-			std::chrono::duration<float> seconds = current_time - loop_start;
-			glUniform1f(glGetUniformLocation(program, "t"), seconds.count());
+			for (size_t i = 0; i != stages.size(); ++i) {
+				vizzy::scene_apply(scene, scene_bindings[i], stages[i].program);
+			}
+
+			{
+				VIZZY_ZONE("uniform upload");
+
+				std::chrono::duration<float> seconds = current_time - loop_start;
+
+				vizzy::FrameHeader header {
+					.aspect = static_cast<float>(h) / static_cast<float>(w),
+					.t = seconds.count(),
+					.frame = static_cast<int32_t>(frame_count),
+					.clock = vizzy::frame_ticks(current_time),
+				};
+
+				vizzy::frame_write(vizzy::gl::storage_begin(storage), header, bank, voices, vizzy::scene_data(scene));
+				vizzy::gl::storage_bind(storage);
+			}
 
-			glUniform1f(glGetUniformLocation(program, "frame"), frame_count);
 			frame_count++;
 
-			// Draw quad
-			glBindVertexArray(vao);
-			glDrawArrays(GL_TRIANGLES, 0, verts.size());
-			glBindVertexArray(0);
+			VIZZY_ZONE("draw");
+
+			vizzy::gl::graph_resize(graph, w, h);
+			vizzy::gl::graph_execute(graph, gpu_profiler, framebuffer);
+		};
+
+		while (running and not offline) {
+			VIZZY_ZONE("frame");
+			vizzy::gl::gpu_frame_begin(gpu_profiler);
+
+			poll_events();
+
+			vizzy::watch_drain(watcher, [&](const vizzy::WatchEvent& ev) {
+				if (not watched[ev.file]) {
+					try {
+						vizzy::scene_reload(scene, vizzy::read_file(scene.path));
+					}
+
+					catch (const vizzy::Fatal& e) {
+						std::cerr << e.what();
+						VIZZY_WARN("cannot reload '{}', keeping previous scene", scene.path.string());
+					}
+
+					return;
+				}
+
+				auto& stage = stages[*watched[ev.file]];
+
+				try {
+					stage.source = vizzy::read_file(stage.path);
+				}
+
+				catch (const vizzy::Fatal& e) {
+					std::cerr << e.what();
+					VIZZY_WARN("cannot reload '{}', keeping previous stage", stage.path.string());
+
+					return;
+				}
+
+				stage.stale = true;
+				stage.changed = ev.changed;
+			});
+
+			for (auto& stage: stages) {
+				vizzy::gl::stage_build(compiler, program_cache, stage, stage_prefix);
+			}
+
+			// Everything from here to the swap is as late as the pacer can make it, envelopes are
+			// evaluated for when the frame will be shown.
+			vizzy::timepoint current_time;
+
+			{
+				VIZZY_ZONE("pace");
+				current_time = vizzy::pacer_wait(pacer);
+			}
+
+			{
+				VIZZY_ZONE("midi drain");
+
+				vizzy::midi_drain(midi_queue, [&](const vizzy::MidiEvent& ev) {
+					auto time = vizzy::midi_time(midi_clock, ev);
+
+					vizzy::bank_trigger(bank, ev, time);
+					vizzy::voice_event(voices, ev, time);
+					vizzy::scene_event(scene, ev);
+
+					if (flags & OPT_SKEW) {
+						vizzy::skew_trigger(skew, time);
+					}
+
+					if (latency_count != 0 and ev.get_message_type() == libremidi::message_type::NOTE_ON and ev.data2 != 0) {
+						vizzy::latency_trigger(latency_stats, vizzy::timepoint { vizzy::clock::duration { ev.received } }, time);
+					}
+				});
+			}
+
+			if (flags & OPT_SKEW) {
+				vizzy::skew_frame(skew, current_time);
+			}
+
+			if (latency_count != 0) {
+				vizzy::latency_frame(latency_stats, current_time);
+			}
+
+			int w, h;
+			vizzy::context_size(context, w, h);
+
+			draw_frame(current_time, vizzy::context_framebuffer(context), w, h);
+
+			vizzy::pacer_rendered(pacer);
 
 			// Swap
-			SDL_GL_SwapWindow(window);
+			{
+				VIZZY_ZONE("swap");
+				vizzy::context_swap(context);
+			}
+
+			vizzy::pacer_presented(pacer);
+
+			vizzy::gl::deletion_frame();
+			vizzy::gl::check_frame();
+
+			if (latency_count != 0) {
+				vizzy::latency_swapped(latency_stats);
+
+				if (latency_injector.done and vizzy::latency_idle(latency_stats)) {
+					running = false;
+				}
+			}
+
+			if (frame_count == max_frames) {
+				running = false;
+			}
+		}
+
+		if (offline) {
+			// Frames are a fixed size so the output doesn't depend on the window, which only shows a preview.
+			constexpr int width = VIZZY_WINDOW_WIDTH;
+			constexpr int height = VIZZY_WINDOW_HEIGHT;
+
+			// Let the last notes ring out.
+			constexpr auto tail = 2s;
+
+			auto target = vizzy::gl::create_target(width, height);
+			auto writer = vizzy::create_frame_writer(output.empty() ? "frames"sv : output, width, height);
+
+			std::chrono::duration<double> period { 1.0 / render_fps };
+			std::chrono::duration<double> length = timeline.length + tail;
+
+			auto total = static_cast<int64_t>(std::ceil(length / period));
+			size_t next = 0;
+
+			if (max_frames != 0) {
+				total = std::min(total, static_cast<int64_t>(max_frames));
+			}
+
+			for (int64_t n = 0; running and n != total; ++n) {
+				VIZZY_ZONE("frame");
+				vizzy::gl::gpu_frame_begin(gpu_profiler);
+
+				poll_events();
+
+				auto current_time = loop_start + std::chrono::duration_cast<vizzy::clock::duration>(period * n);
+
+				// Trigger at the event's own time rather than the frame's so envelopes start part way
+				// through their attack, exactly as they would have live.
+				for (; next != timeline.events.size(); ++next) {
+					auto time = loop_start + timeline.events[next].time;
+
+					if (time > current_time) {
+						break;
+					}
+
+					vizzy::bank_trigger(bank, timeline.events[next].event, time);
+					vizzy::voice_event(voices, timeline.events[next].event, time);
+					vizzy::scene_event(scene, timeline.events[next].event);
+				}
+
+				draw_frame(current_time, target.framebuffer, width, height);
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+				{
+					VIZZY_ZONE("capture");
+					VIZZY_GPU_ZONE(gpu_profiler, "capture");
+
+					vizzy::frame_capture(writer, target.framebuffer, n);
+				}
+
+				// Preview
+				if (context.kind == vizzy::ContextKind::Window) {
+					int w, h;
+					vizzy::context_size(context, w, h);
+
+					glBlitNamedFramebuffer(target.framebuffer, 0, 0, 0, width, height, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+				}
+
+				{
+					VIZZY_ZONE("swap");
+					vizzy::context_swap(context);
+				}
+
+				vizzy::gl::deletion_frame();
+				vizzy::gl::check_frame();
+			}
+
+			vizzy::destroy_frame_writer(writer);
+			vizzy::gl::destroy_target(target);
+
+			std::chrono::duration<double> elapsed = vizzy::clock::now() - loop_start;
+			std::chrono::duration<double> rendered = period * static_cast<double>(writer.written);
+
+			VIZZY_OKAY("wrote {} frames to '{}' in {:.2f}s ({:.1f}x realtime)",
+				writer.written,
+				writer.directory.string(),
+				elapsed.count(),
+				rendered / elapsed);
+		}
+
+		if (not offline) {
+			vizzy::pacer_report(pacer);
+		}
+
+		if (gpu_envelopes) {
+			vizzy::gpu_bank_report(gpu_bank);
+		}
+
+		if (flags & OPT_SKEW) {
+			vizzy::skew_report(skew);
+		}
+
+		if (latency_count != 0) {
+			vizzy::latency_join(latency_injector);
+			vizzy::latency_report(latency_stats);
+		}
+
+		vizzy::gl::destroy_gpu_profiler(gpu_profiler);
+
+		if (not trace.empty()) {
+			vizzy::profile_write_trace(trace);
 		}
 
 		// Cleanup
 		// glDeleteFramebuffers(1, &fbo);
 
-		// glDeleteProgramPipelines(1, &pipeline);
+		vizzy::destroy_watcher(watcher);
+
+		vizzy::destroy_scene(scene);
+		vizzy::scene_report(scene);
 
-		// glDeleteProgram(frag);
-		// glDeleteProgram(vert);
+		vizzy::gl::destroy_effect_chain(effect_chain);
+		vizzy::gl::destroy_render_graph(graph);
+		vizzy::gl::destroy_storage(storage);
+		vizzy::destroy_gpu_bank(gpu_bank);
 
-		glDeleteProgram(program);
+		vizzy::gl::program_cache_report(program_cache);
+		vizzy::gl::destroy_shader_compiler(compiler);
 
-		SDL_DestroyWindow(window);
-		SDL_GL_DeleteContext(gl);
+		// Drop the remaining handles so the flush below actually deletes them.
+		pipeline = {};
+		vao = {};
+		vbo = {};
 
-		SDL_Quit();
+		feedback_program = {};
+		present_program = {};
+
+		for (auto& stage: stages) {
+			stage.program = {};
+		}
+
+		vizzy::gl::deletion_flush();
+		vizzy::destroy_context(context);
 	}
 
 	catch (vizzy::Fatal e) {
@@ -341,5 +982,7 @@ int main(int argc, const char* argv[]) {
 	}
 
 	VIZZY_OKAY("done");
+	vizzy::log_stop();
+
 	return EXIT_SUCCESS;
 }